@@ -0,0 +1,405 @@
+// Micro and macro benchmarks of the raytracer (see the "Benchmarks" chapter in README.md).
+// Usage: raytracer_benchmark [--filter <text>] [--threads <n>] [--repeat <n>] [--compare <old.json>] [<results.json>]
+// Run from the repository root, the macro benchmarks render the scenes of examples and examples2.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/fresnel.h"
+#include "../src/objects.h"
+#include "../src/photonmap.h"
+#include "../src/png.h"
+#include "../src/raytracer.h"
+#include "../src/scene.h"
+#include "../src/wavefobj.h"
+#include "../src/xml.h"
+
+// the scenes of run_examples.sh and run_examples2.sh
+static const std::vector<std::string> MacroScenes{
+    "examples/example1.xml", "examples/example2.xml", "examples/example3.xml",
+    "examples/example4.xml", "examples/example5.xml", "examples/example6.xml",
+    "examples/example7.xml", "examples/example8.xml", "examples/example9_lowres.xml",
+    "examples2/1_transparent.xml", "examples2/2_animation.xml", "examples2/3_motionblur.xml",
+    "examples2/4_julia.xml", "examples2/5_julia_animation.xml", "examples2/6_supersampling.xml",
+    "examples2/7_dof.xml", "examples2/8_fresnel.xml", "examples2/9_caustic.xml",
+    "examples2/10_caustic_texture.xml"
+};
+
+// each micro benchmark repetition runs at least this long
+static const double MICRO_MIN_SECONDS = 0.05;
+// random inputs of the micro benchmarks, cycled through
+static const size_t MICRO_INPUTS = 1024;
+// fixed seed, so every run uses the same inputs
+static const u32 SEED = 1;
+
+// sum of all results, printed at the end so the compiler can not drop the benchmarked code
+static double s_sink = 0.0;
+
+struct BenchmarkResult {
+    std::string name;
+    std::string type; // "micro" or "macro"
+    std::string unit;
+    std::vector<double> values; // of each repetition
+    std::map<std::string, double> details; // additional values, e.g. counters of macro benchmarks
+
+    double median() const {
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+    double min() const { return *std::min_element(values.begin(), values.end()); }
+    double max() const { return *std::max_element(values.begin(), values.end()); }
+};
+
+class Benchmarks {
+public:
+    Benchmarks(const std::string &filter, u32 repetitions, u32 threads) :
+        m_filter{ filter },
+        m_repetitions{ repetitions },
+        m_threads{ threads }
+    {}
+
+    // Runs operation(i) repeatedly with i = 0, 1, 2, ..., each call does opsPerCall operations.
+    // The result is the time per operation.
+    template <typename Operation>
+    void micro(const std::string &name, double opsPerCall, Operation operation) {
+        if (!selected(name)) {
+            return;
+        }
+        BenchmarkResult result{ name, "micro", "ns/op", {}, {} };
+        // calibrate the calls per repetition
+        u64 calls = 1;
+        while (run(calls, operation) < MICRO_MIN_SECONDS) {
+            calls *= 2;
+        }
+        for (u32 i = 0; i < m_repetitions; i++) {
+            result.values.push_back(run(calls, operation) * 1e9 / (calls * opsPerCall));
+        }
+        result.details["calls"] = static_cast<double>(calls);
+        add(std::move(result));
+    }
+
+    // Renders the scene at time 0 (one frame, one subframe), the result is the trace time.
+    void macro(const std::string &sceneFileName) {
+        if (!selected(sceneFileName)) {
+            return;
+        }
+        BenchmarkResult result{ sceneFileName, "macro", "s", {}, {} };
+        auto beginTime{ std::chrono::steady_clock::now() };
+        Scene scene = Scene::load(sceneFileName);
+        scene.setThreads(m_threads);
+        result.details["parseSeconds"] = secondsSince(beginTime);
+        if (scene.photonMapScanSteps() > 0.0f) {
+            beginTime = std::chrono::steady_clock::now();
+            result.details["photons"] = static_cast<double>(PhotonMapper::generate(scene));
+            result.details["photonMapSeconds"] = secondsSince(beginTime);
+        }
+        RayTracer raytracer;
+        for (u32 i = 0; i < m_repetitions; i++) {
+            beginTime = std::chrono::steady_clock::now();
+            const Picture picture = raytracer.raytrace(scene);
+            result.values.push_back(secondsSince(beginTime));
+            s_sink += picture.get({ 0, 0 }).r;
+        }
+        // the counters show if a change alters the work instead of its speed
+        const RayTracer::Statistics &statistics = raytracer.statistics();
+        result.details["threads"] = m_threads;
+        result.details["primaryRays"] = static_cast<double>(statistics.primaryRays);
+        result.details["shadowRays"] = static_cast<double>(statistics.shadowRays);
+        result.details["cachedOccluders"] = static_cast<double>(statistics.cachedOccluders);
+        result.details["reflectionRays"] = static_cast<double>(statistics.reflectionRays);
+        result.details["refractionRays"] = static_cast<double>(statistics.refractionRays);
+        result.details["intersectionTests"] = static_cast<double>(std::accumulate(
+            statistics.intersectionTests.begin(), statistics.intersectionTests.end(), statistics.juliaMarchSteps));
+        add(std::move(result));
+    }
+
+    const std::vector<BenchmarkResult> &results() const { return m_results; }
+
+private:
+    static double secondsSince(std::chrono::steady_clock::time_point beginTime) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+    }
+
+    template <typename Operation>
+    static double run(u64 calls, Operation &operation) {
+        double sum = 0.0;
+        const auto beginTime{ std::chrono::steady_clock::now() };
+        for (u64 i = 0; i < calls; i++) {
+            sum += operation(i);
+        }
+        const double seconds = secondsSince(beginTime);
+        s_sink += sum;
+        return seconds;
+    }
+
+    bool selected(const std::string &name) const {
+        return name.find(m_filter) != std::string::npos;
+    }
+
+    void add(BenchmarkResult result) {
+        std::cout << std::left << std::setw(48) << result.name << std::right << std::setw(14) << result.median()
+            << " " << result.unit << " (min " << result.min() << ", max " << result.max() << ")" << std::endl;
+        m_results.push_back(std::move(result));
+    }
+
+    const std::string m_filter;
+    const u32 m_repetitions;
+    const u32 m_threads;
+    std::vector<BenchmarkResult> m_results;
+};
+
+static std::string readFile(const std::string &fileName) {
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("file " + fileName + " could not be opened");
+    }
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// grid of width x height quads as Wavefront OBJ with texture coordinates and normals
+static std::string gridObj(u32 width, u32 height) {
+    std::ostringstream obj;
+    for (u32 y = 0; y <= height; y++) {
+        for (u32 x = 0; x <= width; x++) {
+            obj << "v " << x << " " << y << " " << (x * y % 7) * 0.1f << "\n";
+            obj << "vt " << static_cast<float>(x) / width << " " << static_cast<float>(y) / height << "\n";
+            obj << "vn 0 0 1\n";
+        }
+    }
+    for (u32 y = 0; y < height; y++) {
+        for (u32 x = 0; x < width; x++) {
+            const u32 v = y * (width + 1) + x + 1;
+            const u32 w = v + width + 1;
+            obj << "f " << v << "/" << v << "/" << v << " " << v + 1 << "/" << v + 1 << "/" << v + 1 << " " << w << "/" << w << "/" << w << "\n";
+            obj << "f " << v + 1 << "/" << v + 1 << "/" << v + 1 << " " << w + 1 << "/" << w + 1 << "/" << w + 1 << " " << w << "/" << w << "/" << w << "\n";
+        }
+    }
+    return obj.str();
+}
+
+// rays from the origin to random points of the square [-size, size]^2 at z = -5
+static std::vector<Ray> randomRays(std::minstd_rand &randGen, scalar size) {
+    std::uniform_real_distribution<float> randDis{ -size, size };
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < MICRO_INPUTS; i++) {
+        rays.emplace_back(Point3{ 0.0f, 0.0f, 0.0f }, Vector3{ randDis(randGen), randDis(randGen), -5.0f });
+    }
+    return rays;
+}
+
+static void microBenchmarks(Benchmarks &benchmarks) {
+    std::minstd_rand randGen{ SEED };
+    const Matrix34 identity = Matrix34::identity();
+
+    // intersections: about half of the rays hit the object
+    const std::vector<Ray> rays = randomRays(randGen, 1.5f);
+    const Sphere sphere{ Point3{ 0.0f, 0.0f, -5.0f }, 1.0f, identity, identity, identity };
+    benchmarks.micro("Sphere::intersect", 1, [&] (u64 i) {
+        const auto intersection = sphere.intersect(rays[i % rays.size()], INFINITE);
+        return intersection ? intersection->distance : 0.0f;
+    });
+    // the normals get transformed by the inverse transposed matrix, for a scale matrix just the inverse
+    const Sphere ellipsoid{ Point3{ 0.0f, 0.0f, 0.0f }, 1.0f,
+        Matrix34::scale({ 1.0f, 2.0f, 1.0f }) * Matrix34::translation({ 0.0f, 0.0f, 5.0f }),
+        Matrix34::translation({ 0.0f, 0.0f, -5.0f }) * Matrix34::scale({ 1.0f, 0.5f, 1.0f }),
+        Matrix34::scale({ 1.0f, 2.0f, 1.0f }) };
+    benchmarks.micro("Sphere::intersect (non-uniform scale)", 1, [&] (u64 i) {
+        const auto intersection = ellipsoid.intersect(rays[i % rays.size()], INFINITE);
+        return intersection ? intersection->distance : 0.0f;
+    });
+    const Triangle triangle{ { {
+        { Point3{ -1.5f, -1.5f, -5.0f }, Vector3{ 0.0f, 0.0f, 1.0f }, Point2{ 0.0f, 0.0f } },
+        { Point3{ 1.5f, -1.5f, -5.0f }, Vector3{ 0.0f, 0.0f, 1.0f }, Point2{ 1.0f, 0.0f } },
+        { Point3{ -1.5f, 1.5f, -5.0f }, Vector3{ 0.0f, 0.0f, 1.0f }, Point2{ 0.0f, 1.0f } }
+    } } };
+    benchmarks.micro("Triangle::intersect", 1, [&] (u64 i) {
+        const auto intersection = triangle.intersect(rays[i % rays.size()], INFINITE);
+        return intersection ? intersection->distance : 0.0f;
+    });
+    // the julia set of examples2/4_julia.xml
+    const Julia julia{ Point3{ 0.0f, 0.0f, -5.0f }, 1.0f, Quaternion{ -0.291f, -0.399f, 0.339f, 0.437f }, 0.0f, identity, identity, identity };
+    benchmarks.micro("Julia::intersect", 1, [&] (u64 i) {
+        u64 marchSteps = 0;
+        const auto intersection = julia.intersect(rays[i % rays.size()], INFINITE, marchSteps);
+        return intersection ? intersection->distance : 0.0f;
+    });
+
+    // fresnel: glass and silver (examples2/8_fresnel.xml) for all angles
+    std::uniform_real_distribution<float> cosDis{ -1.0f, 1.0f };
+    std::vector<scalar> cosAngles(MICRO_INPUTS);
+    std::generate(cosAngles.begin(), cosAngles.end(), [&] { return cosDis(randGen); });
+    Material glass{};
+    glass.refraction = { 1.5f, 0.0f };
+    Material silver{};
+    silver.refraction = { 0.15016f, 3.4727f };
+    benchmarks.micro("calcFresnel", 1, [&] (u64 i) {
+        return calcFresnel<false>(glass, cosAngles[i % cosAngles.size()], 0.0f);
+    });
+    benchmarks.micro("calcFresnel (conductor)", 1, [&] (u64 i) {
+        return calcFresnel<true>(silver, cosAngles[i % cosAngles.size()], 0.0f);
+    });
+
+    // textures
+    const std::string pngData = readFile("examples/mramor6x6.png");
+    std::istringstream pngStream(pngData);
+    const Texture texture = readPNG(pngStream);
+    std::uniform_real_distribution<float> coordDis{ 0.0f, 1.0f };
+    std::vector<Point2> coords(MICRO_INPUTS);
+    std::generate(coords.begin(), coords.end(), [&] { return Point2{ coordDis(randGen), coordDis(randGen) }; });
+    benchmarks.micro("Texture::sample", 1, [&] (u64 i) {
+        return texture.sample(coords[i % coords.size()]).r;
+    });
+    benchmarks.micro("Texture::sample (trilinear)", 1, [&] (u64 i) {
+        return texture.sample(coords[i % coords.size()], 2.5f).r;
+    });
+
+    // file formats
+    const std::string sceneData = readFile("examples2/8_fresnel.xml");
+    // reads all tags like the scene parser, returns the tag count
+    const auto readTags = [&] {
+        std::istringstream in(sceneData);
+        Xml xml(in);
+        u32 tags = 1;
+        while (!xml.nextTag().is("scene", Xml::TagType::End)) {
+            tags++;
+        }
+        return tags;
+    };
+    benchmarks.micro("Xml::nextTag (examples2/8_fresnel.xml)", readTags(), [&] (u64) {
+        return readTags();
+    });
+    const std::string objData = gridObj(100, 100);
+    benchmarks.micro("Mesh::load (20000 triangles)", 1, [&] (u64) {
+        std::istringstream in(objData);
+        const Mesh mesh = Mesh::load(in);
+        return static_cast<double>(mesh.createObjects(glass, identity, identity).size());
+    });
+    benchmarks.micro("readPNG (examples/mramor6x6.png)", 1, [&] (u64) {
+        std::istringstream in(pngData);
+        return static_cast<double>(readPNG(in).size().x);
+    });
+    Picture picture{ { 256, 256 } };
+    for (u32 y = 0; y < 256; y++) {
+        for (u32 x = 0; x < 256; x++) {
+            picture.set({ x, y }, Radiance{ x / 255.0f, y / 255.0f, (x ^ y) / 255.0f, 1.0f });
+        }
+    }
+    benchmarks.micro("writeAPNGFrame (256x256)", 1, [&] (u64) {
+        std::ostringstream out;
+        writeAPNGFrame(out, picture, 1, 25.0f);
+        return static_cast<double>(out.tellp());
+    });
+}
+
+// one line per benchmark, so --compare can read it without a JSON parser
+static void writeResults(std::ostream &out, const std::vector<BenchmarkResult> &results) {
+    // counters need more than the default 6 digits
+    out << std::setprecision(12) << "{ \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &result = results[i];
+        out << "  { \"name\": \"" << result.name << "\", \"type\": \"" << result.type << "\", \"unit\": \"" << result.unit
+            << "\", \"median\": " << result.median() << ", \"min\": " << result.min() << ", \"max\": " << result.max();
+        for (const auto &detail : result.details) {
+            out << ", \"" << detail.first << "\": " << detail.second;
+        }
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "] }\n";
+}
+
+// medians by name of a results file
+static std::map<std::string, double> readMedians(const std::string &fileName) {
+    std::istringstream in(readFile(fileName));
+    std::map<std::string, double> medians;
+    const std::string NAME_KEY = "\"name\": \"";
+    const std::string MEDIAN_KEY = "\"median\": ";
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t name = line.find(NAME_KEY);
+        const size_t median = line.find(MEDIAN_KEY);
+        if (name != std::string::npos && median != std::string::npos) {
+            const size_t nameBegin = name + NAME_KEY.size();
+            medians[line.substr(nameBegin, line.find('"', nameBegin) - nameBegin)] = std::stod(line.substr(median + MEDIAN_KEY.size()));
+        }
+    }
+    return medians;
+}
+
+static void compareResults(const std::vector<BenchmarkResult> &results, const std::string &oldFileName) {
+    const std::map<std::string, double> oldMedians = readMedians(oldFileName);
+    std::cout << "\nCompared with " << oldFileName << " (new / old median, below 1 is faster):" << std::endl;
+    for (const BenchmarkResult &result : results) {
+        const auto old = oldMedians.find(result.name);
+        if (old != oldMedians.end() && old->second > 0.0) {
+            std::cout << std::left << std::setw(48) << result.name << std::right << std::setw(8)
+                << std::fixed << std::setprecision(3) << result.median() / old->second << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [--filter <text>] [--threads <n>] [--repeat <n>] [--compare <old.json>] [<results.json>]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        std::string filter;
+        u32 threads = 1;
+        u32 repetitions = 5;
+        std::optional<std::string> compareFileName;
+        std::optional<std::string> resultsFileName;
+        const std::vector<std::string> args(argv + 1, argv + argc);
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == "--filter" && i + 1 < args.size()) {
+                filter = args[++i];
+            } else if (args[i] == "--threads" && i + 1 < args.size()) {
+                threads = std::max(std::stoi(args[++i]), 1);
+            } else if (args[i] == "--repeat" && i + 1 < args.size()) {
+                repetitions = std::max(std::stoi(args[++i]), 1);
+            } else if (args[i] == "--compare" && i + 1 < args.size()) {
+                compareFileName = args[++i];
+            } else if (!resultsFileName && args[i].compare(0, 2, "--") != 0) {
+                resultsFileName = args[i];
+            } else {
+                printUsage(argv[0]);
+                return -1;
+            }
+        }
+
+        Benchmarks benchmarks(filter, repetitions, threads);
+        microBenchmarks(benchmarks);
+        for (const std::string &scene : MacroScenes) {
+            benchmarks.macro(scene);
+        }
+        std::cout << "(checksum " << s_sink << ")" << std::endl;
+
+        if (resultsFileName) {
+            std::ofstream out(*resultsFileName);
+            writeResults(out, benchmarks.results());
+            if (!out) {
+                throw std::runtime_error("results file could not be written");
+            }
+        }
+        if (compareFileName) {
+            compareResults(benchmarks.results(), *compareFileName);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <istream>
 #include <iterator>
 #include <numeric>
+#include <ostream>
 #include <stdexcept>
+#include <vector>
 
 #include <zlib.h>
 
@@ -79,11 +83,21 @@ public:
         return static_cast<value_type>(*m_it);
     }
     void advance(size_t count = 1) {
-        for (size_t i = 0; i < count; i++) {
-            value_type value = get();
-            m_crc = crc32(m_crc, reinterpret_cast<const unsigned char *>(&value), 1L);
+        std::array<value_type, 4096> buffer;
+        while (count > 0) {
+            const size_t n = std::min(count, buffer.size());
+            readBlock(buffer.data(), n);
+            count -= n;
+        }
+    }
+
+    // reads n bytes into dest, the CRC gets calculated over the whole block at once
+    void readBlock(value_type *dest, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            dest[i] = get();
             ++m_it;
         }
+        m_crc = crc32(m_crc, dest, static_cast<uInt>(n));
     }
 
     // gets and resets the CRC checksum
@@ -134,3 +148,84 @@ private:
     std::istreambuf_iterator<char> m_it;
     uLong m_crc = crc32(0L, Z_NULL, 0);
 };
+
+/* Helpers for the raytracer's own binary files (tile and frame files).
+   Those are stored in little endian byte order,
+   the CRC is calculated over all bytes until it gets reset. */
+class LittleEndianWriter {
+public:
+    explicit LittleEndianWriter(std::ostream &out) : m_out{ out } {}
+
+    void write(u32 value) {
+        std::array<u8, 4> bytes;
+        for (size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = static_cast<u8>((value >> (8 * i)) & 0xff);
+        }
+        writeBytes(bytes.data(), bytes.size());
+    }
+    void write(const float *values, size_t count) {
+        m_buffer.resize(count * sizeof(float));
+        for (size_t i = 0; i < count; i++) {
+            u32 bits;
+            std::memcpy(&bits, &values[i], sizeof bits);
+            for (size_t b = 0; b < 4; b++) {
+                m_buffer[i * 4 + b] = static_cast<u8>((bits >> (8 * b)) & 0xff);
+            }
+        }
+        writeBytes(m_buffer.data(), m_buffer.size());
+    }
+    void writeBytes(const void *data, size_t len) {
+        m_crc = crc32(m_crc, static_cast<const Bytef *>(data), static_cast<uInt>(len));
+        m_out.write(static_cast<const char *>(data), len);
+    }
+
+    // gets and resets the CRC checksum
+    u32 getAndResetCRC() {
+        const u32 crc = static_cast<u32>(m_crc);
+        m_crc = crc32(0L, Z_NULL, 0);
+        return crc;
+    }
+
+private:
+    std::ostream &m_out;
+    uLong m_crc = crc32(0L, Z_NULL, 0);
+    std::vector<u8> m_buffer;
+};
+
+class LittleEndianReader {
+public:
+    explicit LittleEndianReader(std::istream &in) : m_in{ in } {}
+
+    u32 readU32() {
+        std::array<u8, 4> bytes;
+        readBytes(bytes.data(), bytes.size());
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<u32>(bytes[3]) << 24;
+    }
+    void read(float *values, size_t count) {
+        m_buffer.resize(count * sizeof(float));
+        readBytes(m_buffer.data(), m_buffer.size());
+        for (size_t i = 0; i < count; i++) {
+            const u8 *b = &m_buffer[i * 4];
+            const u32 bits = b[0] | b[1] << 8 | b[2] << 16 | static_cast<u32>(b[3]) << 24;
+            std::memcpy(&values[i], &bits, sizeof bits);
+        }
+    }
+    void readBytes(void *data, size_t len) {
+        if (!m_in.read(static_cast<char *>(data), len)) {
+            throw std::runtime_error("file ended prematurely");
+        }
+        m_crc = crc32(m_crc, static_cast<const Bytef *>(data), static_cast<uInt>(len));
+    }
+
+    // gets and resets the CRC checksum
+    u32 getAndResetCRC() {
+        const u32 crc = static_cast<u32>(m_crc);
+        m_crc = crc32(0L, Z_NULL, 0);
+        return crc;
+    }
+
+private:
+    std::istream &m_in;
+    uLong m_crc = crc32(0L, Z_NULL, 0);
+    std::vector<u8> m_buffer;
+};
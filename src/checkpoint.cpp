@@ -0,0 +1,140 @@
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "binfilehelper.h"
+#include "checkpoint.h"
+#include "tiles.h"
+
+static const std::array<char, 8> CheckpointMagic{ 'R', 'T', 'C', 'H', 'E', 'C', 'K', 1 };
+
+u32 fileChecksum(const std::string &fileName) {
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("file " + fileName + " could not be opened");
+    }
+    uLong crc = crc32(0L, Z_NULL, 0);
+    std::array<char, 65536> buffer;
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        crc = crc32(crc, reinterpret_cast<const Bytef *>(buffer.data()), static_cast<uInt>(in.gcount()));
+    }
+    return static_cast<u32>(crc);
+}
+
+void replaceFile(const std::string &tempFileName, const std::string &fileName) {
+    // rename() does not replace existing files on all platforms
+    if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+        std::remove(fileName.c_str());
+        if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+            throw std::runtime_error("file " + fileName + " could not be replaced");
+        }
+    }
+}
+
+// The checkpoint file is stored in little endian byte order:
+//   magic, u32 scene checksum, u32 finished subframes, u32 crc32 of the header values,
+//   followed by a tile file (see tiles.h).
+void writeCheckpoint(const std::string &fileName, u32 sceneChecksum, const Picture &picture, const std::vector<u32> &tiles, u32 subFrames) {
+    const std::string tempFileName = fileName + ".tmp";
+    {
+        std::ofstream out(tempFileName, std::ios::binary);
+        out.write(CheckpointMagic.data(), CheckpointMagic.size());
+        LittleEndianWriter writer(out);
+        writer.write(sceneChecksum);
+        writer.write(subFrames);
+        writer.write(writer.getAndResetCRC());
+        writeTiles(out, picture, tiles);
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("checkpoint file " + tempFileName + " could not be written");
+        }
+    }
+    replaceFile(tempFileName, fileName);
+}
+
+std::optional<Checkpoint> readCheckpoint(const std::string &fileName, u32 sceneChecksum) {
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    try {
+        std::array<char, 8> magic;
+        if (!in.read(magic.data(), magic.size()) || magic != CheckpointMagic) {
+            throw std::runtime_error("wrong checkpoint file header");
+        }
+        LittleEndianReader reader(in);
+        const u32 fileSceneChecksum = reader.readU32();
+        Checkpoint checkpoint;
+        checkpoint.subFrames = reader.readU32();
+        const u32 checksum = reader.getAndResetCRC();
+        if (reader.readU32() != checksum) {
+            throw std::runtime_error("checkpoint file checksum wrong");
+        }
+        if (fileSceneChecksum != sceneChecksum) {
+            throw std::runtime_error("the scene file has changed");
+        }
+        checkpoint.tiles = readTiles(in, checkpoint.picture);
+        return checkpoint;
+    } catch (const std::exception &e) {
+        std::cerr << "WARNING: ignoring checkpoint " << fileName << ": " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+std::vector<u32> resumeFrameFile(const std::string &fileName, const FrameFileInfo &info) {
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in) {
+        return {};
+    }
+    try {
+        FrameFileReader reader(in);
+        if (reader.info() != info) {
+            throw std::runtime_error("the scene file has changed");
+        }
+        const std::vector<u32> frames = reader.frames();
+        if (reader.truncated()) {
+            // copy the complete frames into a new file
+            const std::string tempFileName = fileName + ".tmp";
+            {
+                std::ofstream out(tempFileName, std::ios::binary);
+                FrameFileWriter writer(out, info);
+                for (u32 frame : frames) {
+                    writer.addFrame(frame, reader.readFrame(frame));
+                }
+            }
+            in.close();
+            replaceFile(tempFileName, fileName);
+        }
+        return frames;
+    } catch (const std::exception &e) {
+        std::cerr << "WARNING: ignoring checkpoint " << fileName << ": " << e.what() << std::endl;
+        return {};
+    }
+}
+
+TileCheckpoint::TileCheckpoint(const std::string &fileName, u32 sceneChecksum, std::chrono::seconds interval, std::vector<u32> finishedTiles) :
+    m_fileName{ fileName },
+    m_sceneChecksum{ sceneChecksum },
+    m_interval{ interval },
+    m_tiles{ std::move(finishedTiles) },
+    m_lastWrite{ std::chrono::steady_clock::now() }
+{}
+
+void TileCheckpoint::tileFinished(const Picture &picture, u32 tile) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tiles.push_back(tile);
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_lastWrite >= m_interval) {
+        // the other render threads continue meanwhile, they only block when finishing a tile
+        try {
+            writeCheckpoint(m_fileName, m_sceneChecksum, picture, m_tiles);
+        } catch (const std::exception &e) {
+            // the rendering continues without this checkpoint
+            std::cerr << "WARNING: " << e.what() << std::endl;
+        }
+        m_lastWrite = std::chrono::steady_clock::now();
+    }
+}
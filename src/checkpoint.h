@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "frames.h"
+#include "types.h"
+
+// Checkpoints of long renderings, so an interrupted rendering can be resumed.
+// Images store the finished tiles or the accumulated subframes (motion blur),
+// animations use a frame file (see frames.h).
+
+struct Checkpoint {
+    Picture picture;
+    std::vector<u32> tiles; // finished tiles
+    u32 subFrames = 0; // finished subframes of a motion blur image (all tiles)
+};
+
+// crc32 of a file, used to detect a changed scene file
+u32 fileChecksum(const std::string &fileName);
+
+// Writes the checkpoint file atomically (to a temporary file which replaces the old one).
+void writeCheckpoint(const std::string &fileName, u32 sceneChecksum, const Picture &picture, const std::vector<u32> &tiles, u32 subFrames = 0);
+// Returns nothing if there is no checkpoint file or it belongs to another scene (with a warning)
+std::optional<Checkpoint> readCheckpoint(const std::string &fileName, u32 sceneChecksum);
+// replaces fileName with tempFileName, the old file gets removed
+void replaceFile(const std::string &tempFileName, const std::string &fileName);
+// Prepares a frame file for appending more frames, a broken end (of an interrupted process) gets dropped.
+// Returns the finished frames, nothing if there is no frame file with the same info (with a warning).
+std::vector<u32> resumeFrameFile(const std::string &fileName, const FrameFileInfo &info);
+
+// Collects the finished tiles of a rendering and writes a checkpoint in intervals.
+class TileCheckpoint {
+public:
+    TileCheckpoint(const std::string &fileName, u32 sceneChecksum, std::chrono::seconds interval, std::vector<u32> finishedTiles);
+
+    // called by the render threads (see RayTracer::TileCallback)
+    void tileFinished(const Picture &picture, u32 tile);
+
+private:
+    const std::string m_fileName;
+    const u32 m_sceneChecksum;
+    const std::chrono::seconds m_interval;
+    std::mutex m_mutex;
+    std::vector<u32> m_tiles;
+    std::chrono::steady_clock::time_point m_lastWrite;
+};
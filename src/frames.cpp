@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "binfilehelper.h"
+#include "frames.h"
+
+static const std::array<char, 8> FrameFileMagic{ 'R', 'T', 'F', 'R', 'A', 'M', 'E', 1 };
+
+// The frame file is stored in little endian byte order:
+//   magic, u32 width, u32 height, u32 frame count, u32 scene checksum, u32 crc32 of the header values,
+//   for each frame: u32 frame number, u32 length, the frame data, u32 crc32 of the frame record.
+FrameFileWriter::FrameFileWriter(std::ostream &out, const FrameFileInfo &info) :
+    m_out{ out }
+{
+    m_out.write(FrameFileMagic.data(), FrameFileMagic.size());
+    LittleEndianWriter writer(m_out);
+    writer.write(info.size.x);
+    writer.write(info.size.y);
+    writer.write(info.frameCount);
+    writer.write(info.sceneChecksum);
+    writer.write(writer.getAndResetCRC());
+    m_out.flush();
+    if (!m_out) {
+        throw std::runtime_error("frame file could not be written");
+    }
+}
+
+void FrameFileWriter::addFrame(u32 frameNum, const std::string &frameData) {
+    LittleEndianWriter writer(m_out);
+    writer.write(frameNum);
+    writer.write(static_cast<u32>(frameData.size()));
+    writer.writeBytes(frameData.data(), frameData.size());
+    writer.write(writer.getAndResetCRC());
+    // the frame must be on disk when the process gets interrupted later
+    m_out.flush();
+    if (!m_out) {
+        throw std::runtime_error("frame file could not be written");
+    }
+}
+
+FrameFileReader::FrameFileReader(std::istream &in) :
+    m_in{ in }
+{
+    std::array<char, 8> magic;
+    if (!m_in.read(magic.data(), magic.size()) || magic != FrameFileMagic) {
+        throw std::runtime_error("wrong frame file header");
+    }
+    LittleEndianReader reader(m_in);
+    m_info.size = UDim2{ reader.readU32(), reader.readU32() };
+    m_info.frameCount = reader.readU32();
+    m_info.sceneChecksum = reader.readU32();
+    const u32 headerChecksum = reader.getAndResetCRC();
+    if (reader.readU32() != headerChecksum) {
+        throw std::runtime_error("frame file header checksum wrong");
+    }
+
+    std::vector<char> buffer(65536);
+    while (m_in.peek() != std::istream::traits_type::eof()) {
+        try {
+            reader.getAndResetCRC();
+            const u32 frameNum = reader.readU32();
+            const u32 length = reader.readU32();
+            const std::streamoff offset = m_in.tellg();
+            for (u32 remaining = length; remaining > 0;) {
+                const u32 n = std::min(remaining, static_cast<u32>(buffer.size()));
+                reader.readBytes(buffer.data(), n);
+                remaining -= n;
+            }
+            const u32 checksum = reader.getAndResetCRC();
+            if (reader.readU32() != checksum || frameNum >= m_info.frameCount) {
+                m_truncated = true;
+                break;
+            }
+            m_frames[frameNum] = Entry{ offset, length };
+        } catch (const std::exception &) {
+            // the file ends within a frame
+            m_truncated = true;
+            break;
+        }
+    }
+}
+
+std::vector<u32> FrameFileReader::frames() const {
+    std::vector<u32> frames;
+    for (const auto &frame : m_frames) {
+        frames.push_back(frame.first);
+    }
+    return frames;
+}
+
+std::string FrameFileReader::readFrame(u32 frameNum) {
+    const Entry &entry = m_frames.at(frameNum);
+    std::string data(entry.length, '\0');
+    m_in.clear();
+    m_in.seekg(entry.offset);
+    if (!m_in.read(&data[0], data.size())) {
+        throw std::runtime_error("frame file could not be read");
+    }
+    return data;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Frame file: encoded APNG frames of a part of an animation,
+// for splitting an animation across several processes.
+// Every frame is appended as soon as it is finished and has its own checksum,
+// so the complete frames of an interrupted process are still usable.
+
+struct FrameFileInfo {
+    UDim2 size;
+    u32 frameCount; // frame count of the whole animation
+    u32 sceneChecksum; // detects frames of different scene file versions
+
+    bool operator==(const FrameFileInfo &rhs) const {
+        return size.x == rhs.size.x && size.y == rhs.size.y && frameCount == rhs.frameCount && sceneChecksum == rhs.sceneChecksum;
+    }
+    bool operator!=(const FrameFileInfo &rhs) const { return !operator==(rhs); }
+};
+
+class FrameFileWriter {
+public:
+    FrameFileWriter(std::ostream &out, const FrameFileInfo &info);
+    // continues a frame file, out must be at its end
+    explicit FrameFileWriter(std::ostream &out) : m_out{ out } {}
+
+    // frameData as written by writeAPNGFrame()
+    void addFrame(u32 frameNum, const std::string &frameData);
+
+private:
+    std::ostream &m_out;
+};
+
+class FrameFileReader {
+public:
+    // reads the header and the index of all complete frames
+    explicit FrameFileReader(std::istream &in);
+
+    const FrameFileInfo &info() const { return m_info; }
+    // frame numbers of the complete frames
+    std::vector<u32> frames() const;
+    // the file ends with an incomplete or broken frame
+    bool truncated() const { return m_truncated; }
+    std::string readFrame(u32 frameNum);
+
+private:
+    struct Entry {
+        std::streamoff offset;
+        u32 length;
+    };
+
+    std::istream &m_in;
+    FrameFileInfo m_info;
+    std::map<u32, Entry> m_frames;
+    bool m_truncated = false;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <utility>
+
+#include "objects.h"
+
+// Fresnel reflection coefficient (the rest gets refracted) of a ray hitting a surface of the material,
+//   cos_angle_ray_normal is positive if the ray hits the surface from inside.
+// According https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
+//   extended with distinction (complex numbers)
+//   and dispersion
+// Materials without extinction coefficient use the same calculation with real numbers only.
+template <bool Conductor>
+inline scalar calcFresnel(const Material &material, scalar cos_angle_ray_normal, scalar wavelength) {
+    if constexpr (!Conductor) {
+        scalar etai = 1;
+        scalar etat = material.refraction.real() + wavelength * material.dispersion;
+        if (cos_angle_ray_normal > 0.0f) {
+            // inside
+            std::swap(etai, etat);
+        }
+        const scalar sint = etai / etat * sqrtf(std::max(0.0f, 1 - cos_angle_ray_normal * cos_angle_ray_normal));
+        if (sint * sint < 1.0f) {
+            const scalar cost = sqrtf(1.0f - sint * sint);
+            const scalar cos_angle_ray_normalAbs = fabsf(cos_angle_ray_normal);
+            const scalar Rs = (etat * cos_angle_ray_normalAbs - etai * cost) / (etat * cos_angle_ray_normalAbs + etai * cost);
+            const scalar Rp = (etai * cos_angle_ray_normalAbs - etat * cost) / (etai * cos_angle_ray_normalAbs + etat * cost);
+            return (Rs * Rs + Rp * Rp) / 2;
+        }
+        return 1.0f; // total internal reflection
+    }
+
+    std::complex<scalar> etai = 1;
+    std::complex<scalar> etat = material.refraction + wavelength * material.dispersion;
+    if (cos_angle_ray_normal > 0.0f) {
+        // inside
+        std::swap(etai, etat);
+    }
+    // get the sinus of the incidence angle via the Pythagorean identity
+    // and multiply it with the refraction indices quotient
+    // to get the sinus of the angle the refracted (transmitted) ray
+    const std::complex<scalar> sint = etai / etat * sqrtf(std::max(0.0f, 1 - cos_angle_ray_normal * cos_angle_ray_normal));
+    // check if we do not have total internal reflection
+    if (norm(sint) < 1.0f) {
+        // no total internal reflection -> calculate reflection coefficient
+        // get the cosinus of the refracted angle via the Pythagorean identity
+        //const std::complex<scalar> cost = sqrtf(std::max(0.0f, 1.0f - sint * sint));
+        const std::complex<scalar> cost = sqrt(1.0f - sint * sint);
+        const scalar cos_angle_ray_normalAbs = fabsf(cos_angle_ray_normal);
+        // TODO: check if Rs and Rp are swapped in this formulas? (not important for us, but out of curiousity..)
+        const std::complex<scalar> Rs = (etat * cos_angle_ray_normalAbs - etai * cost) / (etat * cos_angle_ray_normalAbs + etai * cost);
+        const std::complex<scalar> Rp = (etai * cos_angle_ray_normalAbs - etat * cost) / (etai * cos_angle_ray_normalAbs + etat * cost);
+        return (norm(Rs) + norm(Rp)) / 2;
+    }
+
+    return 1.0f; // total internal reflection  
+}
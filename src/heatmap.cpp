@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "heatmap.h"
+
+// colours at equally spaced cost steps, interpolated in between
+static const std::array<Color, 5> HeatmapColors{
+    Color{ 0.0f, 0.0f, 0.0f },
+    Color{ 0.0f, 0.0f, 1.0f },
+    Color{ 1.0f, 0.0f, 0.0f },
+    Color{ 1.0f, 1.0f, 0.0f },
+    Color{ 1.0f, 1.0f, 1.0f }
+};
+
+static const float HEATMAP_MAX_PERCENTILE = 0.99f;
+
+float heatmapMaxCost(const std::vector<float> &pixelCost) {
+    if (pixelCost.empty()) {
+        return 0.0f;
+    }
+    std::vector<float> sorted = pixelCost;
+    const auto percentile = sorted.begin() + static_cast<size_t>(HEATMAP_MAX_PERCENTILE * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    return *percentile;
+}
+
+Picture costHeatmap(UDim2 size, const std::vector<float> &pixelCost) {
+    if (pixelCost.size() != static_cast<size_t>(size.x) * size.y) {
+        throw std::runtime_error("pixel cost size does not match the picture size");
+    }
+    const float maxCost = heatmapMaxCost(pixelCost);
+    const float scale = maxCost > 0.0f ? (HeatmapColors.size() - 1) / maxCost : 0.0f;
+    Picture picture{ size };
+    for (u32 y = 0; y < size.y; y++) {
+        for (u32 x = 0; x < size.x; x++) {
+            const float position = std::min(pixelCost[y * size.x + x] * scale, static_cast<float>(HeatmapColors.size() - 1));
+            const size_t index = std::min(static_cast<size_t>(position), HeatmapColors.size() - 2);
+            const float fraction = position - index;
+            picture.set({ x, y }, HeatmapColors[index] * (1.0f - fraction) + HeatmapColors[index + 1] * fraction);
+        }
+    }
+    return picture;
+}
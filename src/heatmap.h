@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+
+#include "types.h"
+
+// False colour picture of the render cost of every pixel (line by line)
+//   from black (cheap) over blue, red and yellow to white (the most expensive pixels).
+// White is the 99th percentile of the cost, so single outliers (e.g. a preempted thread) do not darken the picture.
+Picture costHeatmap(UDim2 size, const std::vector<float> &pixelCost);
+// the cost shown as white
+float heatmapMaxCost(const std::vector<float> &pixelCost);
@@ -1,178 +1,664 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "checkpoint.h"
+#include "frames.h"
+#include "heatmap.h"
+#include "pfm.h"
 #include "photonmap.h"
 #include "png.h"
 #include "raytracer.h"
+#include "statistics.h"
+#include "tiles.h"
 #include "wavefobj.h"
 
 // TODO: refactor motion blur code into own function and combine those 4 methods into 1
 
+// finished animation frames waiting to be written, limits the memory usage
+static const u32 MAX_QUEUED_FRAMES = 2;
+
+PNGOptions pngOptions(const Scene &scene) {
+    PNGOptions options;
+    options.compressionLevel = static_cast<int>(scene.pngCompression());
+    options.threads = scene.threads();
+    return options;
+}
+
+// rendering only a part of the picture or animation, to split it across several processes
+struct RenderOptions {
+    std::vector<u32> tiles; // empty: all tiles
+    std::optional<PictureRegion> region; // crop the output to this region
+    std::vector<u32> frames; // empty: all frames
+    std::optional<std::chrono::seconds> checkpointInterval; // write checkpoints to resume an interrupted rendering
+    std::optional<std::string> statisticsFileName; // JSON file for the render statistics
+    std::optional<std::string> heatmapFileName; // picture of the render cost of every pixel
+    RayTracer::PixelCost heatmapCost = RayTracer::PixelCost::Time;
+};
+
+Scene loadScene(const std::string &sceneFileName, scalar time, RenderStatistics &statistics) {
+    PhaseTimer timer(statistics.parseSeconds);
+    return Scene::load(sceneFileName, time);
+}
+
+// Loads the scene at the shutter open time, with time sampled motion blur
+//   the objects and the camera move to their state at the shutter close time.
+Scene loadMovingScene(const std::string &sceneFileName, scalar openTime, scalar closeTime, RenderStatistics &statistics) {
+    Scene scene = loadScene(sceneFileName, openTime, statistics);
+    if (scene.timeSampledMotionBlur() && scene.subFrames() > 1) {
+        scene.setMotion(loadScene(sceneFileName, closeTime, statistics));
+    }
+    return scene;
+}
+
+void generatePhotonMap(Scene &scene, RenderStatistics &statistics) {
+    if (scene.photonMapScanSteps() > 0.0f) {
+        PhaseTimer timer(statistics.photonMapSeconds);
+        statistics.photons += PhotonMapper::generate(scene);
+    }
+}
+
+bool hasExtension(const std::string &fileName, const std::string &extension) {
+    return fileName.size() >= extension.size() &&
+        fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// the output format is selected by the file extension: .pfm (HDR) or .png
+void writeImage(const std::string &fileName, const Picture &picture, const PNGOptions &options) {
+    std::ofstream outfile(fileName, std::ios::binary);
+    if (!outfile) {
+        throw std::runtime_error("output file could not be opened");
+    }
+    if (hasExtension(fileName, ".pfm")) {
+        writePFM(outfile, picture);
+    } else {
+        writePNG(outfile, picture, 1.0f, options);
+    }
+}
+
+// partial results are written as tile file (.tiles), regions can also be cropped images
+void writeImage(const Scene &scene, const Picture &picture, const RenderOptions &options) {
+    if (hasExtension(scene.outFileName(), ".tiles")) {
+        std::ofstream outfile(scene.outFileName(), std::ios::binary);
+        if (!outfile) {
+            throw std::runtime_error("output file could not be opened");
+        }
+        std::vector<u32> tiles = options.tiles;
+        if (tiles.empty()) {
+            tiles.resize(picture.tiles().x * picture.tiles().y);
+            std::iota(tiles.begin(), tiles.end(), 0);
+        }
+        writeTiles(outfile, picture, tiles);
+    } else if (options.region) {
+        writeImage(scene.outFileName(), cropPicture(picture, *options.region), pngOptions(scene));
+    } else {
+        writeImage(scene.outFileName(), picture, pngOptions(scene));
+    }
+}
+
+// assembles the tile files of a split rendering, fails with a list of the missing tiles
+void mergeTiles(const std::string &outFileName, const std::vector<std::string> &tileFileNames) {
+    Picture picture;
+    std::vector<bool> rendered;
+    for (const std::string &tileFileName : tileFileNames) {
+        std::ifstream infile(tileFileName, std::ios::binary);
+        if (!infile) {
+            throw std::runtime_error("tile file " + tileFileName + " could not be opened");
+        }
+        // a broken file of a failed process only leads to missing tiles
+        try {
+            for (u32 tile : readTiles(infile, picture)) {
+                rendered.resize(picture.tiles().x * picture.tiles().y);
+                rendered[tile] = true;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "WARNING: skipping " << tileFileName << ": " << e.what() << std::endl;
+        }
+    }
+    if (picture.empty()) {
+        throw std::runtime_error("no valid tile file");
+    }
+    rendered.resize(picture.tiles().x * picture.tiles().y);
+    std::vector<u32> missing;
+    for (u32 tile = 0; tile < rendered.size(); tile++) {
+        if (!rendered[tile]) {
+            missing.push_back(tile);
+        }
+    }
+    if (!missing.empty()) {
+        throw std::runtime_error("missing tiles: " + formatNumberList(missing));
+    }
+    std::cout << "Writing image to " << outFileName << std::endl;
+    PNGOptions options;
+    options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+    writeImage(outFileName, picture, options);
+}
+
+// assembles the frame files of a split animation rendering, fails with a list of the missing frames
+void assembleFrames(const std::string &outFileName, const std::vector<std::string> &frameFileNames) {
+    std::vector<std::unique_ptr<std::ifstream>> files;
+    std::vector<std::unique_ptr<FrameFileReader>> readers;
+    std::map<u32, FrameFileReader *> frames;
+    std::optional<FrameFileInfo> info;
+    for (const std::string &frameFileName : frameFileNames) {
+        files.push_back(std::make_unique<std::ifstream>(frameFileName, std::ios::binary));
+        if (!*files.back()) {
+            throw std::runtime_error("frame file " + frameFileName + " could not be opened");
+        }
+        // a broken file of a failed process only leads to missing frames
+        try {
+            readers.push_back(std::make_unique<FrameFileReader>(*files.back()));
+        } catch (const std::exception &e) {
+            std::cerr << "WARNING: skipping " << frameFileName << ": " << e.what() << std::endl;
+            continue;
+        }
+        const FrameFileReader &reader = *readers.back();
+        if (reader.truncated()) {
+            std::cerr << "WARNING: " << frameFileName << " ends with an incomplete frame" << std::endl;
+        }
+        if (!info) {
+            info = reader.info();
+        } else if (*info != reader.info()) {
+            throw std::runtime_error("frame file " + frameFileName + " belongs to another animation");
+        }
+        for (u32 frame : reader.frames()) {
+            frames[frame] = readers.back().get();
+        }
+    }
+    if (!info) {
+        throw std::runtime_error("no valid frame file");
+    }
+    std::vector<u32> missing;
+    for (u32 frame = 0; frame < info->frameCount; frame++) {
+        if (frames.count(frame) == 0) {
+            missing.push_back(frame);
+        }
+    }
+    if (!missing.empty()) {
+        throw std::runtime_error("missing frames: " + formatNumberList(missing));
+    }
+
+    std::cout << "Writing animation to " << outFileName << std::endl;
+    std::ofstream outfile(outFileName, std::ios::binary);
+    if (!outfile) {
+        throw std::runtime_error("output file could not be opened");
+    }
+    writeAPNGStart(outfile, info->size, info->frameCount);
+    u32 sequenceNumber = 0;
+    for (const auto &frame : frames) {
+        writeAPNGFrameData(outfile, frame.second->readFrame(frame.first), frame.first, sequenceNumber);
+    }
+    writeAPNGEnd(outfile);
+    if (!outfile) {
+        throw std::runtime_error("writing animation failed");
+    }
+}
+
+std::string checkpointFileName(const Scene &scene) {
+    return scene.outFileName() + ".checkpoint";
+}
+
+std::vector<u32> allTiles(const Picture &picture) {
+    std::vector<u32> tiles(picture.tiles().x * picture.tiles().y);
+    std::iota(tiles.begin(), tiles.end(), 0);
+    return tiles;
+}
+
+// The scenes of the subframes of one motion blurred frame.
+// Pixels whose rays only touch static objects are the same in all subframes, so they get rendered
+//   only in the first subframe (see RayTracer::setAnimatedBounds()). This needs a scene where they are
+//   exactly the same, see Scene::staticPixelsReusable(): with random samples every subframe adds its own
+//   samples, which the reuse would drop. Then all scenes get loaded in advance for the bounds of the
+//   animated objects over all subframes, otherwise they are loaded one after another.
+class SubFrameScenes {
+public:
+    SubFrameScenes(const std::string &sceneFileName, std::vector<scalar> times, RenderStatistics &statistics) :
+        m_sceneFileName{ sceneFileName },
+        m_times{ std::move(times) },
+        m_statistics{ statistics }
+    {
+        m_scenes.push_back(loadScene(m_sceneFileName, m_times.front(), m_statistics));
+        const Scene &first = m_scenes.front();
+        if (!first.staticPixelsReusable()) {
+            return;
+        }
+        std::vector<BoundingBox> bounds = first.animatedBounds();
+        for (size_t i = 1; i < m_times.size(); i++) {
+            const Scene &scene = m_scenes.emplace_back(loadScene(m_sceneFileName, m_times[i], m_statistics));
+            const std::vector<BoundingBox> sceneBounds = scene.animatedBounds();
+            for (size_t object = 0; object < bounds.size(); object++) {
+                bounds[object].extend(sceneBounds[object]);
+            }
+        }
+        m_animatedBounds = std::move(bounds);
+    }
+
+    // the scene of the next subframe
+    Scene next() {
+        const size_t subFrame = m_next++;
+        return subFrame < m_scenes.size() ? std::move(m_scenes[subFrame]) : loadScene(m_sceneFileName, m_times[subFrame], m_statistics);
+    }
+    // for RayTracer::setAnimatedBounds(), nothing if the static pixels can not be reused
+    const std::optional<std::vector<BoundingBox>> &animatedBounds() const { return m_animatedBounds; }
+
+private:
+    const std::string m_sceneFileName;
+    const std::vector<scalar> m_times;
+    RenderStatistics &m_statistics;
+    std::vector<Scene> m_scenes;
+    size_t m_next = 0;
+    std::optional<std::vector<BoundingBox>> m_animatedBounds;
+};
+
+// Output of an animation: an APNG file, or a frame file (.frames) for a part of the animation.
+// With checkpoints the frames are collected in a frame file first, which becomes the APNG at the end,
+//   so an interrupted rendering can be resumed with the frames finished before.
+// The frames get encoded and written while the next frame is rendered.
+class AnimationOutput {
+public:
+    AnimationOutput(const Scene &scene, const RenderOptions &options) :
+        m_scene{ scene },
+        m_frameFileName{ hasExtension(scene.outFileName(), ".frames") ? scene.outFileName() :
+            options.checkpointInterval ? checkpointFileName(scene) : std::string{} },
+        m_frames{ options.frames }
+    {
+        if (m_frames.empty()) {
+            m_frames.resize(scene.frames());
+            std::iota(m_frames.begin(), m_frames.end(), 0);
+        }
+        if (m_frameFileName.empty()) {
+            m_outfile.open(scene.outFileName(), std::ios::binary);
+            if (!m_outfile) {
+                throw std::runtime_error("output file could not be opened");
+            }
+            writeAPNGStart(m_outfile, scene.camera().resolution(), scene.frames());
+            m_frameWriter = std::make_unique<APNGFrameWriter>(m_outfile, MAX_QUEUED_FRAMES, 1.0f, pngOptions(scene));
+            return;
+        }
+
+        const FrameFileInfo info{ scene.camera().resolution(), scene.frames(), fileChecksum(scene.sceneFileName()) };
+        const std::vector<u32> finishedFrames = options.checkpointInterval ? resumeFrameFile(m_frameFileName, info) : std::vector<u32>{};
+        m_outfile.open(m_frameFileName, finishedFrames.empty() ? std::ios::binary : std::ios::binary | std::ios::app);
+        if (!m_outfile) {
+            throw std::runtime_error("output file could not be opened");
+        }
+        if (finishedFrames.empty()) {
+            m_frameFile.emplace(m_outfile, info);
+        } else {
+            std::cout << "Resuming from checkpoint with " << finishedFrames.size() << " finished frames" << std::endl;
+            m_frameFile.emplace(m_outfile);
+            m_frames.erase(std::remove_if(m_frames.begin(), m_frames.end(), [&finishedFrames] (u32 frame) {
+                return std::binary_search(finishedFrames.begin(), finishedFrames.end(), frame);
+            }), m_frames.end());
+        }
+        m_frameWriter = std::make_unique<APNGFrameWriter>([this] (u32 frameNum, const std::string &frameData) {
+            m_frameFile->addFrame(frameNum, frameData);
+        }, MAX_QUEUED_FRAMES, 1.0f, pngOptions(scene));
+    }
+
+    // the frames still to render
+    const std::vector<u32> &frames() const { return m_frames; }
+    // complete after finish()
+    double encodeSeconds() const { return m_frameWriter->encodeSeconds(); }
+
+    void addFrame(Picture picture, u32 frameNum, scalar fps) {
+        m_frameWriter->addFrame(std::move(picture), frameNum, fps);
+    }
+
+    void finish() {
+        m_frameWriter->finish();
+        if (m_frameFileName.empty()) {
+            writeAPNGEnd(m_outfile);
+            return;
+        }
+        m_outfile.close();
+        if (m_frameFileName != m_scene.outFileName()) {
+            assembleFrames(m_scene.outFileName(), { m_frameFileName });
+            std::remove(m_frameFileName.c_str());
+        }
+    }
+
+private:
+    const Scene &m_scene;
+    const std::string m_frameFileName; // empty: APNG written directly
+    std::vector<u32> m_frames;
+    std::ofstream m_outfile;
+    std::optional<FrameFileWriter> m_frameFile;
+    std::unique_ptr<APNGFrameWriter> m_frameWriter;
+};
+
 // used for no frame count or frame count == 1
-void renderImage(const Scene &origScene) {
+void renderImage(const Scene &origScene, const RenderOptions &options, RenderStatistics &statistics) {
     scalar startTime = origScene.time() == INFINITE ? 0.0f : origScene.time();
-    Scene scene = Scene::load(origScene.sceneFileName(), startTime);
+    // the shutter time is the same as with subframes (see renderImageMotionBlur())
+    Scene scene = loadMovingScene(origScene.sceneFileName(), startTime, startTime + 1.0f / origScene.frames(), statistics);
     RayTracer raytracer;
+    raytracer.setRecordPixelCost(options.heatmapFileName ? options.heatmapCost : RayTracer::PixelCost::None);
     if (scene.photonMapScanSteps() > 0.0f) {
         std::cout << "Generating photon map for caustics.. This will take some time.." << std::endl;
-        PhotonMapper::generate(scene);
+        generatePhotonMap(scene, statistics);
     }
     std::cout << "Rendering image.." << std::endl;
-    auto beginTime{ std::chrono::high_resolution_clock::now() };
-    const Picture picture = raytracer.raytrace(scene);
-    {
-        std::cout << "Writing image to " << origScene.outFileName() << std::endl;
-        std::ofstream outfile(origScene.outFileName(), std::ios::binary);
-        if (!outfile) {
-            throw std::runtime_error("output file could not be opened");
+    Picture picture{ origScene.camera().resolution() };
+    if (options.checkpointInterval) {
+        // resume with the tiles of the checkpoint, the checkpoint gets updated while rendering
+        const u32 sceneChecksum = fileChecksum(origScene.sceneFileName());
+        std::vector<u32> finishedTiles;
+        if (std::optional<Checkpoint> checkpoint = readCheckpoint(checkpointFileName(origScene), sceneChecksum)) {
+            std::cout << "Resuming from checkpoint with " << checkpoint->tiles.size() << " finished tiles" << std::endl;
+            picture = std::move(checkpoint->picture);
+            finishedTiles = std::move(checkpoint->tiles);
+            std::sort(finishedTiles.begin(), finishedTiles.end());
         }
-        writePNG(outfile, picture, 1.0f);
+        std::vector<u32> tiles = options.tiles.empty() ? allTiles(picture) : options.tiles;
+        tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [&finishedTiles] (u32 tile) {
+            return std::binary_search(finishedTiles.begin(), finishedTiles.end(), tile);
+        }), tiles.end());
+        TileCheckpoint checkpoint(checkpointFileName(origScene), sceneChecksum, *options.checkpointInterval, finishedTiles);
+        if (!tiles.empty()) {
+            PhaseTimer timer(statistics.traceSeconds);
+            raytracer.raytrace(scene, picture, tiles, [&checkpoint] (const Picture &picture, u32 tile) {
+                checkpoint.tileFinished(picture, tile);
+            });
+        }
+    } else {
+        PhaseTimer timer(statistics.traceSeconds);
+        raytracer.raytrace(scene, picture, options.tiles);
+    }
+    statistics.raytracer += raytracer.statistics();
+    std::cout << "Writing image to " << origScene.outFileName() << std::endl;
+    {
+        PhaseTimer timer(statistics.encodeSeconds);
+        writeImage(origScene, picture, options);
+    }
+    if (options.checkpointInterval) {
+        std::remove(checkpointFileName(origScene).c_str());
     }
-    auto endTime{ std::chrono::high_resolution_clock::now() };
-    std::chrono::duration<double> runtime{ endTime - beginTime };
-    std::cout << "\nFinished in " << runtime.count() << " s\n";
 }
 
 // used for no frame count or frame count == 1 and motion blur (subFrame count > 1)
-void renderImageMotionBlur(const Scene &origScene) {
+void renderImageMotionBlur(const Scene &origScene, const RenderOptions &options, RenderStatistics &statistics) {
     scalar startTime = origScene.time() == INFINITE ? 0.0f : origScene.time();
-    Scene sceneForSubFrameCount = Scene::load(origScene.sceneFileName(), startTime);
+    Scene sceneForSubFrameCount = loadScene(origScene.sceneFileName(), startTime, statistics);
     RayTracer raytracer;
+    raytracer.setRecordPixelCost(options.heatmapFileName ? options.heatmapCost : RayTracer::PixelCost::None);
     auto beginTime{ std::chrono::high_resolution_clock::now() };
     u32 subFramesCount = sceneForSubFrameCount.subFrames();
     Picture picture{ origScene.camera().resolution() };
-    for (u32 subFrame = 0; subFrame < subFramesCount; subFrame++) {
+    // resume with the accumulated subframes of the checkpoint
+    u32 firstSubFrame = 0;
+    const u32 sceneChecksum = options.checkpointInterval ? fileChecksum(origScene.sceneFileName()) : 0;
+    const std::vector<u32> tiles = options.tiles.empty() ? allTiles(picture) : options.tiles;
+    auto lastCheckpointTime{ std::chrono::steady_clock::now() };
+    if (options.checkpointInterval) {
+        if (std::optional<Checkpoint> checkpoint = readCheckpoint(checkpointFileName(origScene), sceneChecksum)) {
+            if (checkpoint->subFrames < subFramesCount) {
+                std::cout << "Resuming from checkpoint with " << checkpoint->subFrames << " finished subframes" << std::endl;
+                picture = std::move(checkpoint->picture);
+                firstSubFrame = checkpoint->subFrames;
+            }
+        }
+    }
+    // one subframe at the beginning of the frameTime, one at the end (=beginning of next) frameTime
+    // all others distributed evenly in between
+    std::vector<scalar> subFrameTimes;
+    for (u32 subFrame = firstSubFrame; subFrame < subFramesCount; subFrame++) {
+        subFrameTimes.push_back(static_cast<scalar>(subFrame) / (subFramesCount - 1) / origScene.frames() + startTime);
+    }
+    SubFrameScenes scenes(origScene.sceneFileName(), std::move(subFrameTimes), statistics);
+    raytracer.setAnimatedBounds(scenes.animatedBounds());
+    // keeps the static pixels of the first rendered subframe
+    Picture subPicture{ origScene.camera().resolution() };
+    for (u32 subFrame = firstSubFrame; subFrame < subFramesCount; subFrame++) {
         std::cout << "Rendering image (subframe " << subFrame + 1 << " of " << subFramesCount << ")";
-        if (subFrame > 0) {
+        if (subFrame > firstSubFrame) {
             std::chrono::duration<double> elapsedTime{ std::chrono::high_resolution_clock::now() - beginTime };
-            auto remainingTime = elapsedTime / subFrame * subFramesCount - elapsedTime;
+            auto remainingTime = elapsedTime / (subFrame - firstSubFrame) * (subFramesCount - firstSubFrame) - elapsedTime;
             std::cout << " - Elapsed Time: " << std::chrono::duration_cast<std::chrono::seconds>(elapsedTime).count() << " s";
             std::cout << " - Remaining Time: " << std::chrono::duration_cast<std::chrono::seconds>(remainingTime).count() << " s";
         }
         std::cout << "          \r" << std::flush;
-        // one subframe at the beginning of the frameTime, one at the end (=beginning of next) frameTime
-        // all others distributed evenly in between
-        scalar subFrameTime = static_cast<scalar>(subFrame) / (subFramesCount - 1) / origScene.frames() + startTime;
-        Scene scene = Scene::load(origScene.sceneFileName(), subFrameTime);
-        if (scene.photonMapScanSteps() > 0.0f) {
-            //std::cout << "Generating photon map for caustics.. This will take some time.." << std::endl;
-            PhotonMapper::generate(scene);
+        Scene scene = scenes.next();
+        generatePhotonMap(scene, statistics);
+        {
+            PhaseTimer timer(statistics.traceSeconds);
+            raytracer.raytrace(scene, subPicture, options.tiles);
         }
-        const Picture subPicture = raytracer.raytrace(scene);
+        statistics.raytracer += raytracer.statistics();
         picture.mulAdd(subPicture, 1.0f / subFramesCount);
+        if (options.checkpointInterval && subFrame + 1 < subFramesCount &&
+            std::chrono::steady_clock::now() - lastCheckpointTime >= *options.checkpointInterval) {
+            writeCheckpoint(checkpointFileName(origScene), sceneChecksum, picture, tiles, subFrame + 1);
+            lastCheckpointTime = std::chrono::steady_clock::now();
+        }
     }
+    std::cout << std::endl << "Writing image to " << origScene.outFileName() << std::endl;
     {
-        std::cout << std::endl << "Writing image to " << origScene.outFileName() << std::endl;
-        std::ofstream outfile(origScene.outFileName(), std::ios::binary);
-        if (!outfile) {
-            throw std::runtime_error("output file could not be opened");
-        }
-        writePNG(outfile, picture, 1.0f);
+        PhaseTimer timer(statistics.encodeSeconds);
+        writeImage(origScene, picture, options);
+    }
+    if (options.checkpointInterval) {
+        std::remove(checkpointFileName(origScene).c_str());
     }
-    auto endTime{ std::chrono::high_resolution_clock::now() };
-    std::chrono::duration<double> runtime{ endTime - beginTime };
-    std::cout << "\nFinished in " << runtime.count() << " s\n";
 }
 
 // used for frame count > 1
-void renderVideo(const Scene &origScene) {
+void renderVideo(const Scene &origScene, const RenderOptions &options, RenderStatistics &statistics) {
     RayTracer raytracer;
+    raytracer.setRecordPixelCost(options.heatmapFileName ? options.heatmapCost : RayTracer::PixelCost::None);
     auto beginTime{ std::chrono::high_resolution_clock::now() };
     {
         std::cout << "Writing animation to " << origScene.outFileName() << std::endl;
-        std::ofstream outfile(origScene.outFileName(), std::ios::binary);
-        if (!outfile) {
-            throw std::runtime_error("output file could not be opened");
-        }
-        writeAPNGStart(outfile, origScene.camera().resolution(), origScene.frames());
-        for (u32 frame = 0; frame < origScene.frames(); frame++) {
+        AnimationOutput output(origScene, options);
+        const std::vector<u32> &frames = output.frames();
+        for (size_t i = 0; i < frames.size(); i++) {
+            const u32 frame = frames[i];
             std::cout << "Rendering frame " << frame + 1 << " of " << origScene.frames();
-            if (frame > 0) {
+            if (i > 0) {
                 std::chrono::duration<double> elapsedTime{ std::chrono::high_resolution_clock::now() - beginTime };
-                auto remainingTime = elapsedTime / frame * (origScene.frames() - frame);
+                auto remainingTime = elapsedTime / i * (frames.size() - i);
                 std::cout << " - Elapsed Time: " << std::chrono::duration_cast<std::chrono::seconds>(elapsedTime).count() << " s";
                 std::cout << " - Remaining Time: " << std::chrono::duration_cast<std::chrono::seconds>(remainingTime).count() << " s";
             }
             std::cout << "          \r" << std::flush;
-            Scene scene = Scene::load(origScene.sceneFileName(), static_cast<scalar>(frame) / (origScene.frames() - 1));
-            if (scene.photonMapScanSteps() > 0.0f) {
-                //std::cout << "Generating photon map for caustics.. This will take some time.." << std::endl;
-                PhotonMapper::generate(scene);
-            }
-            const Picture picture = raytracer.raytrace(scene);
-            writeAPNGFrame(outfile, picture, frame, scene.fps());
+            // with time sampled motion blur the frames start at the same times as with subframes (see renderVideoMotionBlur())
+            Scene scene = origScene.timeSampledMotionBlur() && origScene.subFrames() > 1 ?
+                loadMovingScene(origScene.sceneFileName(), static_cast<scalar>(frame) / origScene.frames(),
+                    static_cast<scalar>(frame + 1) / origScene.frames(), statistics) :
+                loadScene(origScene.sceneFileName(), static_cast<scalar>(frame) / (origScene.frames() - 1), statistics);
+            generatePhotonMap(scene, statistics);
+            Picture picture = [&] {
+                PhaseTimer timer(statistics.traceSeconds);
+                return raytracer.raytrace(scene);
+            }();
+            statistics.raytracer += raytracer.statistics();
+            output.addFrame(std::move(picture), frame, scene.fps());
         }
-        writeAPNGEnd(outfile);
+        output.finish();
+        statistics.encodeSeconds += output.encodeSeconds();
     }
-    auto endTime{ std::chrono::high_resolution_clock::now() };
-    std::chrono::duration<double> runtime{ endTime - beginTime };
-    std::cout << "\nFinished in " << runtime.count() << " s\n";
 }
 
 // used for frame count > 1 and motion blur (subFrame count > 1)
-void renderVideoMotionBlur(const Scene &origScene) {
+void renderVideoMotionBlur(const Scene &origScene, const RenderOptions &options, RenderStatistics &statistics) {
     RayTracer raytracer;
+    raytracer.setRecordPixelCost(options.heatmapFileName ? options.heatmapCost : RayTracer::PixelCost::None);
     auto beginTime{ std::chrono::high_resolution_clock::now() };
     {
         std::cout << "Writing animation to " << origScene.outFileName() << std::endl;
-        std::ofstream outfile(origScene.outFileName(), std::ios::binary);
-        if (!outfile) {
-            throw std::runtime_error("output file could not be opened");
-        }
-        writeAPNGStart(outfile, origScene.camera().resolution(), origScene.frames());
+        AnimationOutput output(origScene, options);
+        const std::vector<u32> &frames = output.frames();
         u32 subFramesCount = origScene.subFrames();
-        for (u32 frame = 0; frame < origScene.frames(); frame++) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            const u32 frame = frames[i];
+            if (frame > 0 && (i == 0 || frames[i - 1] != frame - 1)) {
+                // the subFrameCount is taken from the end of the previous frame (= beginning of this frame)
+                subFramesCount = loadScene(origScene.sceneFileName(), static_cast<scalar>(frame) / origScene.frames(), statistics).subFrames();
+            }
             Picture picture{ origScene.camera().resolution() };
             u32 newSubFrameCount = subFramesCount; // allow the scene file to adapt the subFrameCount over the time
+            // one subframe at the beginning of the frameTime, one at the end (=beginning of next) frameTime
+            // all others distributed evenly in between
+            std::vector<scalar> subFrameTimes;
+            for (u32 subFrame = 0; subFrame < subFramesCount; subFrame++) {
+                subFrameTimes.push_back((static_cast<scalar>(frame) + static_cast<scalar>(subFrame) / (subFramesCount - 1)) / origScene.frames());
+            }
+            SubFrameScenes scenes(origScene.sceneFileName(), std::move(subFrameTimes), statistics);
+            raytracer.setAnimatedBounds(scenes.animatedBounds());
+            // keeps the static pixels of the first subframe
+            Picture subPicture{ origScene.camera().resolution() };
             for (u32 subFrame = 0; subFrame < subFramesCount; subFrame++) {
                 std::cout << "Rendering frame " << frame + 1 << " of " << origScene.frames() << " (subframe " << subFrame + 1 << " of " << subFramesCount << ")";
-                if (frame > 0 || subFrame > 0) {
+                if (i > 0 || subFrame > 0) {
                     std::chrono::duration<double> elapsedTime{ std::chrono::high_resolution_clock::now() - beginTime };
-                    auto remainingTime = elapsedTime / (frame * subFramesCount + subFrame) * origScene.frames() * subFramesCount - elapsedTime;
+                    auto remainingTime = elapsedTime / (i * subFramesCount + subFrame) * frames.size() * subFramesCount - elapsedTime;
                     std::cout << " - Elapsed Time: " << std::chrono::duration_cast<std::chrono::seconds>(elapsedTime).count() << " s";
                     std::cout << " - Remaining Time: " << std::chrono::duration_cast<std::chrono::seconds>(remainingTime).count() << " s";
                 }
                 std::cout << "          \r" << std::flush;
-                // one subframe at the beginning of the frameTime, one at the end (=beginning of next) frameTime
-                // all others distributed evenly in between
-                scalar subFrameTime = (static_cast<scalar>(frame) + static_cast<scalar>(subFrame) / (subFramesCount - 1)) / origScene.frames();
-                Scene scene = Scene::load(origScene.sceneFileName(), subFrameTime);
-                if (scene.photonMapScanSteps() > 0.0f) {
-                    //std::cout << "Generating photon map for caustics.. This will take some time.." << std::endl;
-                    PhotonMapper::generate(scene);
+                Scene scene = scenes.next();
+                generatePhotonMap(scene, statistics);
+                {
+                    PhaseTimer timer(statistics.traceSeconds);
+                    raytracer.raytrace(scene, subPicture, {});
                 }
-                const Picture subPicture = raytracer.raytrace(scene);
+                statistics.raytracer += raytracer.statistics();
                 picture.mulAdd(subPicture, 1.0f / subFramesCount);
                 newSubFrameCount = scene.subFrames();
             }
-            writeAPNGFrame(outfile, picture, frame, origScene.fps());
+            output.addFrame(std::move(picture), frame, origScene.fps());
             subFramesCount = newSubFrameCount;
         }
-        writeAPNGEnd(outfile);
+        output.finish();
+        statistics.encodeSeconds += output.encodeSeconds();
     }
-    auto endTime{ std::chrono::high_resolution_clock::now() };
-    std::chrono::duration<double> runtime{ endTime - beginTime };
-    std::cout << "\nFinished in " << runtime.count() << " s\n";
+}
+
+void printUsage(const char *program) {
+    std::cout << "Usage: " << std::endl
+        << program << " <scene.xml> [<out.png>|<out.pfm>|<out.tiles>|<out.frames>] [--tiles <list>] [--region <x,y,width,height>]" << std::endl
+        << "    [--frames <list>] [--shard <index>/<count>] [--checkpoint <seconds>]" << std::endl
+        << "    [--stats <statistics.json>] [--heatmap <heatmap.png>|<heatmap.pfm>]" << std::endl
+        << "    [--heatmap-cost time|tests]" << std::endl
+        << program << " --merge <out.png>|<out.pfm> <in.tiles>..." << std::endl
+        << program << " --assemble <out.png> <in.frames>..." << std::endl;
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        std::cout << "Usage: "<< std::endl << argv[0] << " <scene.xml> [<out.png>]" << std::endl;
+        printUsage(argv[0]);
         return -1;
     }
-    const char *sceneFilename = argv[1];
     try {
-        Scene scene = Scene::load(sceneFilename);
-        if (argc >= 3) {
-            scene.setOutFileName(argv[2]);
+        const std::vector<std::string> args(argv + 1, argv + argc);
+        if (args[0] == "--merge" || args[0] == "--assemble") {
+            if (args.size() < 3) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            const std::vector<std::string> inFileNames(args.begin() + 2, args.end());
+            if (args[0] == "--merge") {
+                mergeTiles(args[1], inFileNames);
+            } else {
+                assembleFrames(args[1], inFileNames);
+            }
+            return 0;
+        }
+
+        RenderOptions options;
+        std::optional<std::string> outFileName;
+        std::optional<std::string> tileList;
+        std::optional<std::string> frameList;
+        std::optional<std::string> shard;
+        for (size_t i = 1; i < args.size(); i++) {
+            if ((args[i] == "--tiles" || args[i] == "--region") && i + 1 < args.size()) {
+                if (tileList || options.region) {
+                    throw std::runtime_error("only one of --tiles and --region can be used");
+                }
+                if (args[i] == "--tiles") {
+                    tileList = args[i + 1];
+                } else {
+                    options.region = parseRegion(args[i + 1]);
+                }
+                i++;
+            } else if ((args[i] == "--frames" || args[i] == "--shard") && i + 1 < args.size()) {
+                if (frameList || shard) {
+                    throw std::runtime_error("only one of --frames and --shard can be used");
+                }
+                (args[i] == "--frames" ? frameList : shard) = args[i + 1];
+                i++;
+            } else if (args[i] == "--stats" && i + 1 < args.size()) {
+                options.statisticsFileName = args[i + 1];
+                i++;
+            } else if (args[i] == "--heatmap" && i + 1 < args.size()) {
+                options.heatmapFileName = args[i + 1];
+                i++;
+            } else if (args[i] == "--heatmap-cost" && i + 1 < args.size()) {
+                if (args[i + 1] == "time") {
+                    options.heatmapCost = RayTracer::PixelCost::Time;
+                } else if (args[i + 1] == "tests") {
+                    options.heatmapCost = RayTracer::PixelCost::IntersectionTests;
+                } else {
+                    throw std::runtime_error("unknown heatmap cost " + args[i + 1]);
+                }
+                i++;
+            } else if (args[i] == "--checkpoint" && i + 1 < args.size()) {
+                const int seconds = std::stoi(args[i + 1]);
+                if (seconds <= 0) {
+                    throw std::runtime_error("checkpoint interval must be positive");
+                }
+                options.checkpointInterval = std::chrono::seconds{ seconds };
+                i++;
+            } else if (!outFileName && args[i].compare(0, 2, "--") != 0) {
+                outFileName = args[i];
+            } else {
+                printUsage(argv[0]);
+                return -1;
+            }
+        }
+
+        const auto beginTime{ std::chrono::steady_clock::now() };
+        RenderStatistics statistics;
+        Scene scene = loadScene(args[0], 0.0f, statistics);
+        if (outFileName) {
+            scene.setOutFileName(*outFileName);
+        }
+        // the lists are parsed with the scene, the numbers are checked against its tile and frame count
+        if (options.region) {
+            options.tiles = regionTiles(scene.camera().resolution(), *options.region);
+        } else if (tileList) {
+            if (!hasExtension(scene.outFileName(), ".tiles")) {
+                throw std::runtime_error("Rendering tiles needs a .tiles output file.");
+            }
+            options.tiles = parseNumberList(*tileList, pictureTileCount(scene.camera().resolution()));
+        }
+        if (hasExtension(scene.outFileName(), ".tiles")) {
+            checkTilePictureSize(scene.camera().resolution());
+        }
+        if (frameList) {
+            options.frames = parseNumberList(*frameList, scene.frames());
+        } else if (shard) {
+            options.frames = parseShard(*shard, scene.frames());
+        }
+        if ((frameList || shard) && !hasExtension(scene.outFileName(), ".frames")) {
+            throw std::runtime_error("Rendering a part of an animation needs a .frames output file.");
         }
         // some performance warnings
         if (scene.dispersionMode()) {
             std::cout << "Rendering with dispersion effect. This will increase rendering time." << std::endl;
         }
-        if (scene.camera().superSamplingPerAxis() > 1) {
+        if (scene.camera().samplesPerPixel() > 1) {
             std::cout << "Rendering with supersampling. This will increase rendering time." << std::endl;
         } else if (scene.camera().lensSize() != 0.0f) {
             throw std::runtime_error("Depth of field needs supersampling.");
@@ -187,17 +673,49 @@ int main(int argc, char *argv[]) {
         }
 
         if (scene.frames() > 1 && scene.time() == INFINITE) {
-            if (scene.subFrames() > 1) {
-                renderVideoMotionBlur(scene);
+            if (hasExtension(scene.outFileName(), ".pfm") || hasExtension(scene.outFileName(), ".tiles")) {
+                throw std::runtime_error("PFM and tile output is only supported for single images.");
+            }
+            if (!options.tiles.empty()) {
+                throw std::runtime_error("Tiles and regions are only supported for single images.");
+            }
+            if (scene.subFrames() > 1 && !scene.timeSampledMotionBlur()) {
+                renderVideoMotionBlur(scene, options, statistics);
             } else {
-                renderVideo(scene);
+                renderVideo(scene, options, statistics);
             }
         } else {
-            if (scene.subFrames() > 1) {
-                renderImageMotionBlur(scene);
+            if (hasExtension(scene.outFileName(), ".frames")) {
+                throw std::runtime_error("Frame files are only supported for animations.");
+            }
+            if (scene.subFrames() > 1 && !scene.timeSampledMotionBlur()) {
+                renderImageMotionBlur(scene, options, statistics);
+            } else {
+                renderImage(scene, options, statistics);
+            }
+        }
+        statistics.totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+        std::cout << "\nFinished in " << statistics.totalSeconds << " s\n";
+        printStatistics(std::cout, statistics);
+        if (options.statisticsFileName) {
+            std::ofstream statisticsFile(*options.statisticsFileName);
+            writeStatisticsJSON(statisticsFile, statistics);
+            if (!statisticsFile) {
+                throw std::runtime_error("statistics file could not be written");
+            }
+        }
+        if (options.heatmapFileName) {
+            // pixels not rendered (other tiles, resumed from a checkpoint) stay black
+            const UDim2 resolution = scene.camera().resolution();
+            std::vector<float> pixelCost = statistics.raytracer.pixelCost;
+            pixelCost.resize(resolution.x * resolution.y);
+            std::cout << "Writing cost heatmap to " << *options.heatmapFileName << " (white: ";
+            if (options.heatmapCost == RayTracer::PixelCost::Time) {
+                std::cout << heatmapMaxCost(pixelCost) * 1000.0f << " ms per pixel)" << std::endl;
             } else {
-                renderImage(scene);
+                std::cout << heatmapMaxCost(pixelCost) << " intersection tests per pixel)" << std::endl;
             }
+            writeImage(*options.heatmapFileName, costHeatmap(resolution, pixelCost), pngOptions(scene));
         }
     } catch (const std::exception &e) {
         std::cerr << "ERROR: " << e.what() << std::endl;
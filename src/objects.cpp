@@ -1,27 +1,151 @@
 #include <algorithm>
 #include <cmath>
+#include <stdexcept>
 
 #include "objects.h"
 
 // TODO: bounding boxes
 // TODO: fast intersection algorithm (kd tree?)
 
+static const u32 POLAR_DECOMPOSITION_ITERATIONS = 100;
+static const scalar POLAR_DECOMPOSITION_CONVERGENCE_LIMIT = 1e-6f;
+// quaternions closer than this get interpolated linearly, as the spherical interpolation divides by the sine of the angle
+static const scalar SLERP_MIN_ANGLE = 0.001f;
+
+// the 3x3 part of m, without translation
+static Matrix34 withoutTranslation(Matrix34 m) {
+    m.m[0][3] = m.m[1][3] = m.m[2][3] = 0.0f;
+    return m;
+}
+
+// rotation of the polar decomposition m = rotation * stretch of the 3x3 part of m:
+//   averaging with the inverse transposed converges to the closest orthogonal matrix
+static Matrix34 polarRotation(const Matrix34 &m) {
+    Matrix34 rotation = withoutTranslation(m);
+    for (u32 i = 0; i < POLAR_DECOMPOSITION_ITERATIONS; i++) {
+        const Matrix34 next = (rotation + rotation.inverse().transposed()) * 0.5f;
+        scalar change = 0.0f;
+        for (u8 r = 0; r < 3; r++) {
+            for (u8 c = 0; c < 3; c++) {
+                change = std::max(change, fabsf(next.m[r][c] - rotation.m[r][c]));
+            }
+        }
+        rotation = next;
+        if (change < POLAR_DECOMPOSITION_CONVERGENCE_LIMIT) {
+            break;
+        }
+    }
+    return rotation;
+}
+
+static scalar determinant(const Matrix34 &m) {
+    return Vector3{ m.m[0][0], m.m[1][0], m.m[2][0] }.dot(
+        Vector3{ m.m[0][1], m.m[1][1], m.m[2][1] }.cross(Vector3{ m.m[0][2], m.m[1][2], m.m[2][2] }));
+}
+
+// unit quaternion (r is the real part) of a rotation matrix
+static Quaternion rotationQuaternion(const Matrix34 &m) {
+    const scalar trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+    // the largest component gets calculated first for precision
+    if (trace > 0.0f) {
+        const scalar s = 2.0f * sqrtf(trace + 1.0f);
+        return { 0.25f * s, (m.m[2][1] - m.m[1][2]) / s, (m.m[0][2] - m.m[2][0]) / s, (m.m[1][0] - m.m[0][1]) / s };
+    }
+    if (m.m[0][0] > m.m[1][1] && m.m[0][0] > m.m[2][2]) {
+        const scalar s = 2.0f * sqrtf(1.0f + m.m[0][0] - m.m[1][1] - m.m[2][2]);
+        return { (m.m[2][1] - m.m[1][2]) / s, 0.25f * s, (m.m[0][1] + m.m[1][0]) / s, (m.m[0][2] + m.m[2][0]) / s };
+    }
+    if (m.m[1][1] > m.m[2][2]) {
+        const scalar s = 2.0f * sqrtf(1.0f + m.m[1][1] - m.m[0][0] - m.m[2][2]);
+        return { (m.m[0][2] - m.m[2][0]) / s, (m.m[0][1] + m.m[1][0]) / s, 0.25f * s, (m.m[1][2] + m.m[2][1]) / s };
+    }
+    const scalar s = 2.0f * sqrtf(1.0f + m.m[2][2] - m.m[0][0] - m.m[1][1]);
+    return { (m.m[1][0] - m.m[0][1]) / s, (m.m[0][2] + m.m[2][0]) / s, (m.m[1][2] + m.m[2][1]) / s, 0.25f * s };
+}
+
+// rotation matrix of a unit quaternion
+static Matrix34 rotationMatrix(const Quaternion &q) {
+    return {
+        1.0f - 2.0f * (q.b * q.b + q.c * q.c), 2.0f * (q.a * q.b - q.c * q.r), 2.0f * (q.a * q.c + q.b * q.r), 0.0f,
+        2.0f * (q.a * q.b + q.c * q.r), 1.0f - 2.0f * (q.a * q.a + q.c * q.c), 2.0f * (q.b * q.c - q.a * q.r), 0.0f,
+        2.0f * (q.a * q.c - q.b * q.r), 2.0f * (q.b * q.c + q.a * q.r), 1.0f - 2.0f * (q.a * q.a + q.b * q.b), 0.0f
+    };
+}
+
+TransformationMotion::TransformationMotion(const Matrix34 &open, const Matrix34 &close) {
+    const std::array<const Matrix34 *, 2> transformations{ &open, &close };
+    for (size_t i = 0; i < 2; i++) {
+        const Matrix34 &m = *transformations[i];
+        m_translations[i] = Vector3{ m.m[0][3], m.m[1][3], m.m[2][3] };
+        Matrix34 rotation = polarRotation(m);
+        // a mirroring transformation gets a negative stretch, so the rotation stays a proper rotation
+        if (determinant(rotation) < 0.0f) {
+            rotation = rotation * -1.0f;
+        }
+        // stretch = rotation^-1 * m, the transposed rotation is its inverse
+        m_stretches[i] = rotation.transposed() * withoutTranslation(m);
+        m_rotations[i] = rotationQuaternion(rotation);
+    }
+    scalar cosAngle = m_rotations[0].r * m_rotations[1].r + m_rotations[0].a * m_rotations[1].a +
+        m_rotations[0].b * m_rotations[1].b + m_rotations[0].c * m_rotations[1].c;
+    // q and -q are the same rotation, the one closer to the open rotation is the shorter way
+    if (cosAngle < 0.0f) {
+        m_rotations[1] = m_rotations[1] * -1.0f;
+        cosAngle = -cosAngle;
+    }
+    m_angle = acosf(std::min(cosAngle, 1.0f));
+}
+
+Matrix34 TransformationMotion::at(scalar t) const {
+    Quaternion rotation;
+    if (m_angle < SLERP_MIN_ANGLE) {
+        rotation = lerp(m_rotations[0], m_rotations[1], t);
+        rotation = rotation * (1.0f / rotation.length());
+    } else {
+        rotation = (m_rotations[0] * sinf((1.0f - t) * m_angle) + m_rotations[1] * sinf(t * m_angle)) * (1.0f / sinf(m_angle));
+    }
+    Matrix34 ret = rotationMatrix(rotation) * lerp(m_stretches[0], m_stretches[1], t);
+    const Vector3 translation = lerp(m_translations[0], m_translations[1], t);
+    ret.m[0][3] = translation.x;
+    ret.m[1][3] = translation.y;
+    ret.m[2][3] = translation.z;
+    return ret;
+}
+
 std::optional<Intersection> Sphere::intersect(const Ray &ray, scalar max_distance) const {
+    // a sphere without non-uniform scaling is still a sphere in world coordinates
+    // and can be intersected there directly
+    return m_worldScale != 0.0f ? intersectWorld(ray, max_distance) : intersectObject(ray, max_distance);
+}
+
+// bounds of the sphere at center with radius transformed by object2World (an ellipsoid):
+//   the extent along a world axis is the radius times the length of the matrix row
+static BoundingBox transformedSphereBounds(const Point3 &center, scalar radius, const Matrix34 &object2World) {
+    const Point3 worldCenter = object2World * center;
+    auto extent = [&object2World, radius] (u8 row) {
+        const scalar (&m)[4] = object2World.m[row];
+        return radius * sqrtf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+    };
+    const Vector3 extents{ extent(0), extent(1), extent(2) };
+    BoundingBox box;
+    box.extend(worldCenter - extents);
+    box.extend(worldCenter + extents);
+    return box;
+}
+
+BoundingBox Sphere::bounds() const {
+    return transformedSphereBounds(m_center, m_radius, m_object2World);
+}
+
+std::optional<Intersection> Sphere::intersectWorld(const Ray &ray, scalar max_distance) const {
     // according https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-sphere-intersection
     // this calculates the intersection by solving the
     // quadratic equation which is the result of combining
     // the parametric form of a ray and a sphere
-    const Point3 objectRay_origin = m_world2Object * ray.origin();
-    const Vector3 objectRay_direction = m_world2Object.mulWithoutTranslate(ray.direction()).normalized();
-    scalar objectMax_distance = INFINITE;
-    if (max_distance != INFINITE) {
-        objectMax_distance = (objectRay_origin - m_world2Object * (ray.origin() + ray.direction() * max_distance)).length();
-    }
-    
-    const Vector3 ray_center_vector = objectRay_origin - m_center;
+    const Vector3 ray_center_vector = ray.origin() - m_worldCenter;
     // a of the quadratic equation is always 1 for normalized ray directions
-    const scalar b = ray_center_vector.dot(objectRay_direction);
-    const scalar c = ray_center_vector.dot(ray_center_vector) - m_radius * m_radius;
+    const scalar b = ray_center_vector.dot(ray.direction());
+    const scalar c = ray_center_vector.dot(ray_center_vector) - m_worldRadius * m_worldRadius;
     const scalar h = b * b - c;
     // the part under the sqrt is negative -> no real solution -> we do not intersect
     if (h < 0.0f) {
@@ -30,31 +154,103 @@ std::optional<Intersection> Sphere::intersect(const Ray &ray, scalar max_distanc
     // if h = 0 we touch the sphere in 1 point
     // in any other case we have 2 solutions
     // check first the smaller value
-    scalar distance = -b - sqrt(h); 
-    if (distance > objectMax_distance) {
+    scalar distance = -b - sqrt(h);
+    if (distance > max_distance) {
         return std::nullopt;
     }
     if (distance < 0) {
         // ray origin is inside or after the sphere
         distance = -b + sqrt(h);
-        if (distance < 0 || distance > objectMax_distance) {
+        if (distance < 0 || distance > max_distance) {
             // ray origin is after the sphere
             return std::nullopt;
         }
     }
+    const Point3 intersectionPoint = ray.origin() + ray.direction() * distance;
+    const Vector3 normal = (intersectionPoint - m_worldCenter) * (1.0f / m_worldRadius);
+    // the texture coordinates are defined in object coordinates
+    // world2Object is only rotating back and scaling by 1 / m_worldScale here
+    const Vector3 objectNormal = m_world2Object.mulWithoutTranslate(normal * m_worldScale).normalized();
+    const Point2 textureCoordinate{ 0.5f + std::atan2(objectNormal.x, objectNormal.z) / (2.0f * PI), 0.5f - std::asin(objectNormal.y) / PI };
+    // u runs once around the equator, v from pole to pole
+    const Dim2 textureScale{ 1.0f / (2.0f * PI * m_worldRadius), 1.0f / (PI * m_worldRadius) };
+    return Intersection{ distance, intersectionPoint, normal, textureCoordinate, textureCoordinate, textureScale };
+}
+
+std::optional<Intersection> Sphere::intersectObject(const Ray &ray, scalar max_distance) const {
+    // same as intersectWorld, but in object coordinates
+    // The object ray direction does not get normalized. So the ray parameter
+    // of the solution is the same as for the world ray and it is already the world distance.
+    const Point3 objectRay_origin = m_world2Object * ray.origin();
+    const Vector3 objectRay_direction = m_world2Object.mulWithoutTranslate(ray.direction());
+
+    const Vector3 ray_center_vector = objectRay_origin - m_center;
+    const scalar a = objectRay_direction.dot(objectRay_direction);
+    const scalar b = ray_center_vector.dot(objectRay_direction);
+    const scalar c = ray_center_vector.dot(ray_center_vector) - m_radius * m_radius;
+    const scalar h = b * b - a * c;
+    if (h < 0.0f) {
+        return std::nullopt;
+    }
+    scalar distance = (-b - sqrt(h)) / a;
+    if (distance > max_distance) {
+        return std::nullopt;
+    }
+    if (distance < 0) {
+        distance = (-b + sqrt(h)) / a;
+        if (distance < 0 || distance > max_distance) {
+            return std::nullopt;
+        }
+    }
     const Point3 objectIntersectionPoint = objectRay_origin + objectRay_direction * distance;
     const Vector3 objectNormal = (objectIntersectionPoint - m_center).normalized();
     const Point2 textureCoordinate{ 0.5f + std::atan2(objectNormal.x, objectNormal.z) / (2.0f * PI), 0.5f - std::asin(objectNormal.y) / PI };
-    const scalar worldDistance = (ray.origin() - m_object2World * objectIntersectionPoint).length();
-    return Intersection{ worldDistance, m_object2World * objectIntersectionPoint, (m_object2WorldNormals * objectNormal).normalized(), textureCoordinate, textureCoordinate };
+    // approximated by the scaling along the ray, as the world surface is an ellipsoid
+    const scalar world2ObjectDistance = sqrt(a);
+    const Dim2 textureScale{ world2ObjectDistance / (2.0f * PI * m_radius), world2ObjectDistance / (PI * m_radius) };
+    return Intersection{ distance, ray.origin() + ray.direction() * distance, (m_object2WorldNormals * objectNormal).normalized(), textureCoordinate, textureCoordinate, textureScale };
+}
+
+// Texture coordinate change per world distance unit,
+// approximated isotropic by comparing the areas of the triangle in texture and world space.
+scalar Triangle::calcTextureScale(const std::array<Vertex, 3> &vertices) {
+    const scalar worldArea = (vertices[1].position - vertices[0].position).cross(vertices[2].position - vertices[0].position).length();
+    const Vector2 textureEdge1 = vertices[1].textureCoordinate - vertices[0].textureCoordinate;
+    const Vector2 textureEdge2 = vertices[2].textureCoordinate - vertices[0].textureCoordinate;
+    const scalar textureArea = fabsf(textureEdge1.x * textureEdge2.y - textureEdge1.y * textureEdge2.x);
+    return worldArea > 0.0f ? sqrtf(textureArea / worldArea) : 0.0f;
+}
+
+BoundingBox Triangle::bounds() const {
+    BoundingBox box;
+    for (const Vertex &vertex : m_vertices) {
+        box.extend(vertex.position);
+    }
+    return box;
 }
 
 std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_distance) const {
+    return intersect(ray, max_distance, m_vertices[0].position, m_vertices[1].position, m_vertices[2].position,
+        [this] (size_t i) { return m_vertices[i].normal; }, m_textureScale);
+}
+
+std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_distance, const Triangle &close, scalar t) const {
+    return intersect(ray, max_distance,
+        lerp(m_vertices[0].position, close.m_vertices[0].position, t),
+        lerp(m_vertices[1].position, close.m_vertices[1].position, t),
+        lerp(m_vertices[2].position, close.m_vertices[2].position, t),
+        [this, &close, t] (size_t i) { return lerp(m_vertices[i].normal, close.m_vertices[i].normal, t); },
+        lerp(m_textureScale, close.m_textureScale, t));
+}
+
+template <typename VertexNormal>
+std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_distance, const Point3 &position0, const Point3 &position1, const Point3 &position2,
+    VertexNormal vertexNormal, scalar textureScale) const {
     // Variable names in comments are from the descriptions in
     // Hughes - Computer Graphics 3rd Edition (variable name before ; ) and
     // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm (name after ; )
-    const Vector3 edge1 = m_vertices[1].position - m_vertices[0].position; // e1; edge1
-    const Vector3 edge2 = m_vertices[2].position - m_vertices[0].position; // e2; edge2
+    const Vector3 edge1 = position1 - position0; // e1; edge1
+    const Vector3 edge2 = position2 - position0; // e2; edge2
 
     const Vector3 raydir_edge2_normal = ray.direction().cross(edge2); // q; h
     const scalar approach_rate = edge1.dot(raydir_edge2_normal); // a; a
@@ -62,7 +258,7 @@ std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_dista
     //if (fabs(approach_rate) < EPSILON) {  // without backface culling
     //    return std::nullopt;
     //}
-    const Vector3 ray_c0_vector = ray.origin() - m_vertices[0].position; // s; s
+    const Vector3 ray_c0_vector = ray.origin() - position0; // s; s
     const scalar bary_weight1 = ray_c0_vector.dot(raydir_edge2_normal) / approach_rate; // weight1; u
     // compare with -EPSILON instead of 0.0f to allow a bit of overlapping of 2 triangles
     if (bary_weight1 < -EPSILON || bary_weight1 > 1.0f) {
@@ -84,9 +280,9 @@ std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_dista
 
     const Point3 intersectionPoint = ray.origin() + ray.direction() * distance;
     const Vector3 normal = (
-        m_vertices[0].normal * bary_weight0 +
-        m_vertices[1].normal * bary_weight1 +
-        m_vertices[2].normal * bary_weight2
+        vertexNormal(0) * bary_weight0 +
+        vertexNormal(1) * bary_weight1 +
+        vertexNormal(2) * bary_weight2
     ).normalized();
 
     const Point2 textureCoordinate {
@@ -95,7 +291,7 @@ std::optional<Intersection> Triangle::intersect(const Ray &ray, scalar max_dista
         m_vertices[2].textureCoordinate * bary_weight2
     };
     const Point2 photonCoordinate { bary_weight0, bary_weight1 };
-    return Intersection{ distance, intersectionPoint, normal, textureCoordinate, photonCoordinate };
+    return Intersection{ distance, intersectionPoint, normal, textureCoordinate, photonCoordinate, { textureScale, textureScale } };
 }
 
 // many constants for the Julia Set raytracer...
@@ -104,9 +300,15 @@ static const u32 JULIA_INTERSECT_SEARCH_ITERATIONS = 10240;
 static const scalar JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT = 0.0001f;
 static const scalar JULIA_INTERSECT_SEARCH_DIVERGENCE_LIMIT = 10000.0f;
 static const u32 JULIA_INTERSECT_DISTANCE_ITERATIONS = 10000;
+static const u32 JULIA_INTERSECT_MIN_DISTANCE_ITERATIONS = 200;
+static const scalar JULIA_INTERSECT_FOOTPRINT_FACTOR = 0.05f; // part of the pixel footprint used as convergence limit
+static const scalar JULIA_INTERSECT_OVERRELAXATION = 1.2f;
 static const scalar JULIA_NORMALS_GRADIENT_DIFF = 0.005f;
 static const u32 JULIA_NORMALS_GRADIENT_DISTANCE_ITERATIONS = 8;
 static const bool JULIA_NORMALS_TURN_AGAINST_RAY = true;
+// the sphere circumscribing a cube with edge length of 2 (-1..+1) in object coordinates
+static const scalar JULIA_BOUNDING_SPHERE_RADIUS = sqrtf(3);
+static const bool JULIA_NORMALS_ANALYTIC = false; // analytic jacobian instead of the smoother gradient
 
 // Estimator for distance to Julia set:
 // This function is calculating the distance to the f(x) = 0 isosurface
@@ -125,7 +327,7 @@ scalar Julia::estimateDistance(Quaternion z0, u32 iterations) const {
     scalar m2 = z.squaredLength();
     for (u32 i = 0; i < iterations; i++) {
         d2 *= 4.0f * m2;
-        z = z * z + m_c;
+        z = z.squared() + m_c;
         m2 = z.squaredLength();
         if (m2 > 1e10f) {
             break;
@@ -134,6 +336,50 @@ scalar Julia::estimateDistance(Quaternion z0, u32 iterations) const {
     return sqrt(m2 / d2) * 0.5f * log(sqrt(m2));
 }
 
+// Same as estimateDistance() for N orbits at once.
+// The orbits are stored as structure of arrays and escaped orbits get frozen
+// instead of leaving the loop, so the compiler can vectorize the loops over the lanes.
+template <size_t N>
+std::array<scalar, N> Julia::estimateDistances(const std::array<Quaternion, N> &starts, u32 iterations) const {
+    std::array<scalar, N> zr, za, zb, zc, d2, m2;
+    std::array<bool, N> active;
+    for (size_t l = 0; l < N; l++) {
+        zr[l] = starts[l].r;
+        za[l] = starts[l].a;
+        zb[l] = starts[l].b;
+        zc[l] = starts[l].c;
+        d2[l] = 1.0f;
+        m2[l] = starts[l].squaredLength();
+        active[l] = true;
+    }
+    for (u32 i = 0; i < iterations; i++) {
+        bool running = false;
+        for (size_t l = 0; l < N; l++) {
+            const scalar r = zr[l] * zr[l] - za[l] * za[l] - zb[l] * zb[l] - zc[l] * zc[l] + m_c.r;
+            const scalar a = 2.0f * zr[l] * za[l] + m_c.a;
+            const scalar b = 2.0f * zr[l] * zb[l] + m_c.b;
+            const scalar c = 2.0f * zr[l] * zc[l] + m_c.c;
+            const scalar m = r * r + a * a + b * b + c * c;
+            d2[l] = active[l] ? d2[l] * 4.0f * m2[l] : d2[l];
+            zr[l] = active[l] ? r : zr[l];
+            za[l] = active[l] ? a : za[l];
+            zb[l] = active[l] ? b : zb[l];
+            zc[l] = active[l] ? c : zc[l];
+            m2[l] = active[l] ? m : m2[l];
+            active[l] = active[l] && m <= 1e10f;
+            running |= active[l];
+        }
+        if (!running) {
+            break;
+        }
+    }
+    std::array<scalar, N> distances;
+    for (size_t l = 0; l < N; l++) {
+        distances[l] = sqrt(m2[l] / d2[l]) * 0.5f * log(sqrt(m2[l]));
+    }
+    return distances;
+}
+
 // Calculate normals using gradient on the surface, according the idea from:
 // Hart, J, Sandin, D & Kauffman, L, 1989. Ray tracing deterministic 3-D fractals. ACM SIGGRAPH Computer GraphicsJuly 1989, pp.289-296.
 // There are improved algorithms available, which could be evaluated.
@@ -146,11 +392,12 @@ Vector3 Julia::estimateNormal(Quaternion pos, scalar diff) const {
         Quaternion{ 0.0f, 0.0f, diff, 0.0f },
         Quaternion{ 0.0f, 0.0f, -diff, 0.0f }
     };
-    std::array<scalar, 6> distances;
+    std::array<Quaternion, 6> samples;
     
-    std::transform(grad_q_diff.begin(), grad_q_diff.end(), std::begin(distances), [this, &pos] (const Quaternion &qdiff) {
-        return estimateDistance(pos + qdiff, JULIA_NORMALS_GRADIENT_DISTANCE_ITERATIONS);
+    std::transform(grad_q_diff.begin(), grad_q_diff.end(), std::begin(samples), [&pos] (const Quaternion &qdiff) {
+        return pos + qdiff;
     });
+    const std::array<scalar, 6> distances = estimateDistances(samples, JULIA_NORMALS_GRADIENT_DISTANCE_ITERATIONS);
 
     return Vector3{
         distances[0] - distances[1],
@@ -159,42 +406,80 @@ Vector3 Julia::estimateNormal(Quaternion pos, scalar diff) const {
     }.normalized();
 }
 
-std::optional<Intersection> Julia::intersect(const Ray &ray, scalar max_distance) const {
+// Calculate normals analytically as gradient of |z_n|^2 using the jacobian of the iteration, according
+// https://iquilezles.org/articles/juliasets3d/
+// It needs only one orbit, but is more noisy than the gradient from estimateNormal() because it is exact.
+Vector3 Julia::calculateNormal(Quaternion pos, u32 iterations) const {
+    // transposed jacobian J^T of z_n with respect to z_0, the constant factor 2 of each step gets skipped
+    std::array<std::array<scalar, 4>, 4> jt{{
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f },
+        { 0.0f, 0.0f, 0.0f, 1.0f }
+    }};
+    Quaternion z = pos;
+    for (u32 i = 0; i < iterations; i++) {
+        // chain rule: J^T = J^T * D^T with D = jacobian of z^2
+        for (auto &row : jt) {
+            row = {
+                row[0] * z.r - row[1] * z.a - row[2] * z.b - row[3] * z.c,
+                row[0] * z.a + row[1] * z.r,
+                row[0] * z.b + row[2] * z.r,
+                row[0] * z.c + row[3] * z.r
+            };
+        }
+        z = z.squared() + m_c;
+        if (z.squaredLength() > 1e10f) {
+            break;
+        }
+    }
+    // gradient = J^T * z_n, the cut plane component is not needed
+    auto gradient = [&jt, &z] (size_t n) { return jt[n][0] * z.r + jt[n][1] * z.a + jt[n][2] * z.b + jt[n][3] * z.c; };
+    return Vector3{ gradient(0), gradient(1), gradient(2) }.normalized();
+}
+
+BoundingBox Julia::bounds() const {
+    // the object coordinates are (world2Object * p - m_position) / m_scale
+    return transformedSphereBounds(m_position, m_scale * JULIA_BOUNDING_SPHERE_RADIUS, m_object2World);
+}
+
+std::optional<Intersection> Julia::intersect(const Ray &ray, scalar max_distance, u64 &marchSteps) const {
 
     // transform back into object coordinates
-    Point3 test_pos = (m_world2Object * ray.origin() - m_position) * (1.0f / m_scale);
-    const Vector3 ray_direction = m_world2Object.mulWithoutTranslate(ray.direction()).normalized();
+    const Point3 start_pos = (m_world2Object * ray.origin() - m_position) * (1.0f / m_scale);
+    const Vector3 objectRay_direction = m_world2Object.mulWithoutTranslate(ray.direction());
+    // factor converting world distances along this ray into object distances
+    const scalar world2ObjectDistance = objectRay_direction.length() / m_scale;
+    const Vector3 ray_direction = objectRay_direction * (1.0f / objectRay_direction.length());
+    const scalar objectMax_distance = max_distance == INFINITE ? INFINITE : max_distance * world2ObjectDistance;
 
     // directly jump along the ray to the bounding box surface intersection 
     //   and start the distance estimator from that intersection point
     //   because 1. speed and 2. it seems the distance estimator does not work perfectly far away
 
     // jump along ray to bounding sphere of julia set, which is the sphere circumsribing a cube with edge length of 2 (-1..+1)
-    const scalar BOUNDING_SPHERE_RADIUS = sqrtf(3);
-    if (test_pos.length() > BOUNDING_SPHERE_RADIUS) {
-        // code from sphere intersection
-        // a of the quadratic equation is always 1 for normalized ray directions
-        const scalar b = test_pos.dot(ray_direction);
-        const scalar c = test_pos.dot(test_pos) - BOUNDING_SPHERE_RADIUS * BOUNDING_SPHERE_RADIUS;
-        const scalar h = b * b - c;
-        // the part under the sqrt is negative -> no real solution -> we do not intersect
-        // or it is =0 -> we touch the sphere -> no interesection with julia set
-        if (h <= 0.0f) {
-            return std::nullopt;
-        }
+    // code from sphere intersection
+    // a of the quadratic equation is always 1 for normalized ray directions
+    const scalar b = start_pos.dot(ray_direction);
+    const scalar c = start_pos.dot(start_pos) - JULIA_BOUNDING_SPHERE_RADIUS * JULIA_BOUNDING_SPHERE_RADIUS;
+    const scalar h = b * b - c;
+    // the part under the sqrt is negative -> no real solution -> we do not intersect
+    // or it is =0 -> we touch the sphere -> no interesection with julia set
+    if (h <= 0.0f) {
+        return std::nullopt;
+    }
+    // leaving the bounding sphere or passing an already found nearer object ends the search
+    const scalar exit_distance = std::min(-b + sqrtf(h), objectMax_distance);
+    scalar ray_distance = 0.0f;
+    if (c > 0.0f) {
+        // ray origin is outside the bounding sphere
         // in any other case we have 2 solutions
         // check first the smaller value
-        scalar distance = -b - sqrt(h);
-        /* TODO: consider max_distance here
-        if (distance > objectMax_distance) {
+        ray_distance = -b - sqrtf(h);
+        if (ray_distance < 0 || ray_distance > exit_distance) {
+            // ray origin is after the sphere or the sphere is behind a nearer object
             return std::nullopt;
         }
-        */
-        if (distance < 0) {
-            // ray origin is inside (can not be, was checked before) or after the sphere
-            return std::nullopt;
-        }
-        test_pos = test_pos + ray_direction * distance;
     }
 
     // This is an experiment to look into the inside of the set, but the results are strange.
@@ -202,26 +487,60 @@ std::optional<Intersection> Julia::intersect(const Ray &ray, scalar max_distance
     // try to cut through it on Z=0:
     //test_pos = test_pos + ray_direction * test_pos.z;
 
-    scalar distance;
+    // Adaptive precision: it is enough to find the surface with a precision of
+    //   about the pixel footprint. Less precision needs less iterations of the distance estimator.
+    const scalar footprintWorld2Object = JULIA_INTERSECT_FOOTPRINT_FACTOR * world2ObjectDistance;
+    const scalar footprintWidth = ray.footprint(0.0f) * footprintWorld2Object;
+    const scalar footprintSpread = ray.footprintSpread() * JULIA_INTERSECT_FOOTPRINT_FACTOR;
+
+    // Over-relaxed sphere tracing according
+    //   Keinert, B et al., 2014. Enhanced Sphere Tracing. Smart Tools and Apps for Graphics.
+    // Steps are enlarged by omega. If the unbounding spheres of two steps do not overlap
+    //   we might have jumped over the surface. Then go back and continue with normal steps.
+    scalar omega = JULIA_INTERSECT_OVERRELAXATION;
+    scalar step_length = 0.0f;
+    scalar previous_distance = 0.0f;
+    scalar distance = INFINITE;
+    scalar convergence_limit = JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT;
+    Point3 test_pos = start_pos + ray_direction * ray_distance;
     for (u32 i = 0; i < JULIA_INTERSECT_SEARCH_ITERATIONS; i++) {
+        marchSteps++;
+        convergence_limit = std::max(JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT, footprintWidth + footprintSpread * ray_distance);
+        const u32 iterations = std::max(JULIA_INTERSECT_MIN_DISTANCE_ITERATIONS,
+            static_cast<u32>(JULIA_INTERSECT_DISTANCE_ITERATIONS * JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT / convergence_limit));
+        test_pos = start_pos + ray_direction * ray_distance;
         Quaternion q{ test_pos.x, test_pos.y, test_pos.z, m_cutPlane };
-        distance = estimateDistance(q, JULIA_INTERSECT_DISTANCE_ITERATIONS);
-        if (i == 0 && distance < JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT) {
-            distance = 100 * JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT;
+        distance = estimateDistance(q, iterations);
+        if (i == 0 && distance < convergence_limit) {
+            // ray starts on the surface, leave it far enough to not find it again
+            distance = std::max(100 * JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT, 2 * convergence_limit);
             //return std::nullopt;
-        } else if (distance < JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT  ||
-            distance > JULIA_INTERSECT_SEARCH_DIVERGENCE_LIMIT) {
-            break;
         }
-        test_pos = test_pos + ray_direction * distance;
+        const bool overrelaxationFailed = omega > 1.0f && fabsf(distance) + previous_distance < step_length;
+        if (overrelaxationFailed) {
+            step_length -= omega * step_length;
+            omega = 1.0f;
+        } else {
+            if (distance < convergence_limit) {
+                break;
+            }
+            if (distance > JULIA_INTERSECT_SEARCH_DIVERGENCE_LIMIT || ray_distance > exit_distance) {
+                return std::nullopt;
+            }
+            step_length = distance * omega;
+        }
+        previous_distance = fabsf(distance);
+        ray_distance += step_length;
     }
 
-    if (distance >= JULIA_INTERSECT_SEARCH_CONVERGENCE_LIMIT) {
+    if (distance >= convergence_limit) {
         return std::nullopt;
     }
 
     const Quaternion q{ test_pos.x, test_pos.y, test_pos.z, m_cutPlane };
-    Vector3 normal = estimateNormal(q, JULIA_NORMALS_GRADIENT_DIFF);
+    Vector3 normal = JULIA_NORMALS_ANALYTIC ?
+        calculateNormal(q, JULIA_NORMALS_GRADIENT_DISTANCE_ITERATIONS) :
+        estimateNormal(q, JULIA_NORMALS_GRADIENT_DIFF);
     // simulate that it is 2-sided by turning the normal always against the ray
     if (JULIA_NORMALS_TURN_AGAINST_RAY && normal.dot(ray_direction) > 0.0f) {
         normal = normal * -1.0f;
@@ -238,7 +557,41 @@ std::optional<Intersection> Julia::intersect(const Ray &ray, scalar max_distance
     }
 
     const Point2 textureCoordinate{ 0, 0 }; // texturing not supported :(
-    return Intersection{ intersectionDistance, intersectionPoint, (m_object2WorldNormals * normal).normalized(), textureCoordinate, textureCoordinate };
+    return Intersection{ intersectionDistance, intersectionPoint, (m_object2WorldNormals * normal).normalized(), textureCoordinate, textureCoordinate, { 0.0f, 0.0f } };
+}
+
+void Object::setMotion(const Object &close) {
+    if (close.m_object.index() != m_object.index()) {
+        throw std::runtime_error("an object changes its type within the motion blur time");
+    }
+    const bool moves = std::visit([&close] (const auto &obj) {
+        return !(obj == std::get<std::decay_t<decltype(obj)>>(close.m_object));
+    }, m_object);
+    if (!moves) {
+        m_motion = nullptr;
+        return;
+    }
+    m_motion = std::visit([&close] (const auto &obj) {
+        using T = std::decay_t<decltype(obj)>;
+        if constexpr (std::is_same_v<T, Triangle>) {
+            return std::make_shared<const Motion>(Motion{ close.m_object, std::nullopt });
+        } else {
+            return std::make_shared<const Motion>(Motion{ close.m_object,
+                TransformationMotion(obj.object2World(), std::get<T>(close.m_object).object2World()) });
+        }
+    }, m_object);
+}
+
+std::optional<Intersection> Object::intersectMoving(const Ray &ray, scalar max_distance, u64 &juliaMarchSteps) const {
+    return std::visit([this, &ray, max_distance, &juliaMarchSteps] (const auto &obj) {
+        using T = std::decay_t<decltype(obj)>;
+        const T &close = std::get<T>(m_motion->close);
+        if constexpr (std::is_same_v<T, Triangle>) {
+            return obj.intersect(ray, max_distance, close, ray.time());
+        } else {
+            return intersect(obj.interpolate(close, *m_motion->transformation, ray.time()), ray, max_distance, juliaMarchSteps);
+        }
+    }, m_object);
 }
 
 void Object::addPhoton(u32 textureSize, Point2 pos, Radiance rad) {
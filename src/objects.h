@@ -2,9 +2,13 @@
 
 #include <array>
 #include <complex>
+#include <memory>
 #include <optional>
+#include <type_traits>
 #include <variant>
 
+#include "sampler.h"
+#include "texture.h"
 #include "types.h"
 
 struct Intersection {
@@ -13,11 +17,24 @@ struct Intersection {
     Vector3 normal;
     Point2 textureCoordinate;
     Point2 photonCoordinate;
+    Dim2 textureScale; // change of the texture coordinates per world distance unit on the surface (0 for untextured)
 };
 
 struct Material {
+    // Shading classes are bit flags which get combined.
+    // They are determined once by classify() after loading
+    // and select a specialised shading function in the raytracer.
+    enum ShadingClass : u8 {
+        Diffuse = 0,          // opaque, phong shading only
+        Textured = 1 << 0,    // color gets read from texture
+        Reflective = 1 << 1,  // casts fresnel reflection rays
+        Transparent = 1 << 2, // casts fresnel refraction rays, back faces are visible
+        Conductor = 1 << 3,   // complex refraction index (extinction coefficient)
+        ShadingClassCount = 1 << 4
+    };
+
     Color color;
-    Picture texture;
+    Texture texture;
     struct {
         scalar ka;
         scalar kd;
@@ -28,6 +45,45 @@ struct Material {
     scalar transmittance;
     std::complex<scalar> refraction;
     scalar dispersion;
+    u8 shadingClass = Diffuse;
+
+    // Let transmittance and reflectance values enable/disable refraction and reflection according
+    //   https://moodle.univie.ac.at/mod/forum/discuss.php?d=1811598
+    void classify() {
+        const bool refractive = norm(refraction) > 0.0f;
+        shadingClass = Diffuse;
+        if (!texture.empty()) {
+            shadingClass |= Textured;
+        }
+        if (refractive && reflectance != 0.0f) {
+            shadingClass |= Reflective;
+        }
+        if (refractive && transmittance != 0.0f) {
+            shadingClass |= Transparent;
+        }
+        if ((shadingClass & (Reflective | Transparent)) && refraction.imag() != 0.0f) {
+            shadingClass |= Conductor;
+        }
+    }
+};
+
+// Motion between two object to world transformations (motion blur).
+//   Lerping the matrices element by element would shrink rotating objects, so both get decomposed
+//   into translation, rotation and stretch (polar decomposition): the rotation is interpolated
+//   spherically, the others linearly, see K. Shoemake, T. Duff: Matrix Animation and Polar Decomposition (1992).
+class TransformationMotion {
+public:
+    TransformationMotion(const Matrix34 &open, const Matrix34 &close);
+
+    // the transformation at t in [0, 1], open at 0 and close at 1
+    Matrix34 at(scalar t) const;
+
+private:
+    Vector3 m_translations[2];
+    Matrix34 m_stretches[2];
+    // unit quaternions of the rotations, the close one on the same hemisphere for the shorter way
+    Quaternion m_rotations[2];
+    scalar m_angle; // between the rotation quaternions
 };
 
 // TODO: remove position, center, scale from Objects and replace with matrix transformations
@@ -39,20 +95,44 @@ public:
         m_radius{ radius },
         m_world2Object { world2Object },
         m_object2World { object2World },
-        m_object2WorldNormals { object2WorldNormals }
+        m_object2WorldNormals { object2WorldNormals },
+        m_worldScale{ object2World.uniformScale() },
+        m_worldCenter{ object2World * center },
+        m_worldRadius{ radius * m_worldScale }
     {}
 
     const Point3 &center() const { return m_center; }
     scalar radius() const { return m_radius; }
 
     std::optional<Intersection> intersect(const Ray &ray, scalar max_distance) const;
+    BoundingBox bounds() const;
+
+    const Matrix34 &object2World() const { return m_object2World; }
+    // for motion blur: the sphere moved from this (t = 0) to close (t = 1),
+    //   motion is the one of both object2World() transformations
+    Sphere interpolate(const Sphere &close, const TransformationMotion &motion, scalar t) const {
+        const Matrix34 object2World = motion.at(t);
+        const Matrix34 world2Object = object2World.inverse();
+        return Sphere{ lerp(m_center, close.m_center, t), lerp(m_radius, close.m_radius, t), world2Object, object2World, world2Object.transposed() };
+    }
+    bool operator==(const Sphere &rhs) const {
+        return m_center == rhs.m_center && m_radius == rhs.m_radius && m_world2Object == rhs.m_world2Object &&
+            m_object2World == rhs.m_object2World && m_object2WorldNormals == rhs.m_object2WorldNormals;
+    }
 
 private:
+    std::optional<Intersection> intersectWorld(const Ray &ray, scalar max_distance) const;
+    std::optional<Intersection> intersectObject(const Ray &ray, scalar max_distance) const;
+
     Point3 m_center;
     scalar m_radius;
     Matrix34 m_world2Object;
     Matrix34 m_object2World;
     Matrix34 m_object2WorldNormals;
+    // precalculated for spheres without non-uniform scaling, which stay spheres in world coordinates
+    scalar m_worldScale; // 0 for non-uniform scaling
+    Point3 m_worldCenter;
+    scalar m_worldRadius;
 };
 
 class Triangle {
@@ -64,13 +144,33 @@ public:
     };
 
     Triangle(const std::array<Vertex, 3> &vertices) :
-        m_vertices{ vertices }
+        m_vertices{ vertices },
+        m_textureScale{ calcTextureScale(vertices) }
     {}
 
     std::optional<Intersection> intersect(const Ray &ray, scalar max_distance) const;
+    BoundingBox bounds() const;
+
+    // for motion blur: intersects the triangle moved from this (t = 0) to close (t = 1),
+    //   the normals are only interpolated for a hit
+    std::optional<Intersection> intersect(const Ray &ray, scalar max_distance, const Triangle &close, scalar t) const;
+    bool operator==(const Triangle &rhs) const {
+        for (size_t i = 0; i < m_vertices.size(); i++) {
+            if (m_vertices[i].position != rhs.m_vertices[i].position || m_vertices[i].normal != rhs.m_vertices[i].normal) {
+                return false;
+            }
+        }
+        return true;
+    }
 
 private:
+    static scalar calcTextureScale(const std::array<Vertex, 3> &vertices);
+    template <typename VertexNormal>
+    std::optional<Intersection> intersect(const Ray &ray, scalar max_distance, const Point3 &position0, const Point3 &position1, const Point3 &position2,
+        VertexNormal vertexNormal, scalar textureScale) const;
+
     std::array<Vertex, 3> m_vertices;
+    scalar m_textureScale;
 };
 
 class Julia {
@@ -86,11 +186,30 @@ public:
         m_object2WorldNormals{ object2WorldNormals }
     {}
 
-    std::optional<Intersection> intersect(const Ray &ray, scalar max_distance) const;
+    // marchSteps gets increased by the sphere tracing steps
+    std::optional<Intersection> intersect(const Ray &ray, scalar max_distance, u64 &marchSteps) const;
+    // of the bounding sphere used by intersect()
+    BoundingBox bounds() const;
+
+    const Matrix34 &object2World() const { return m_object2World; }
+    // for motion blur: the julia set moved from this (t = 0) to close (t = 1), see Sphere::interpolate()
+    Julia interpolate(const Julia &close, const TransformationMotion &motion, scalar t) const {
+        const Matrix34 object2World = motion.at(t);
+        const Matrix34 world2Object = object2World.inverse();
+        return Julia{ lerp(m_position, close.m_position, t), lerp(m_scale, close.m_scale, t), lerp(m_c, close.m_c, t),
+            lerp(m_cutPlane, close.m_cutPlane, t), world2Object, object2World, world2Object.transposed() };
+    }
+    bool operator==(const Julia &rhs) const {
+        return m_position == rhs.m_position && m_scale == rhs.m_scale && m_c == rhs.m_c && m_cutPlane == rhs.m_cutPlane &&
+            m_world2Object == rhs.m_world2Object && m_object2World == rhs.m_object2World && m_object2WorldNormals == rhs.m_object2WorldNormals;
+    }
 
 private:
     scalar estimateDistance(Quaternion start, u32 iterations) const;
+    template <size_t N>
+    std::array<scalar, N> estimateDistances(const std::array<Quaternion, N> &starts, u32 iterations) const;
     Vector3 estimateNormal(Quaternion pos, scalar diff) const;
+    Vector3 calculateNormal(Quaternion pos, u32 iterations) const;
 
     Point3 m_position;
     scalar m_scale;
@@ -103,6 +222,14 @@ private:
 
 class Object {
 public:
+    // the alternatives of m_object
+    enum class PrimitiveType : u8 {
+        Sphere,
+        Triangle,
+        Julia
+    };
+    static constexpr size_t PrimitiveTypeCount = 3;
+
     Object(const Point3 &center, scalar radius, const Material &material,
         const Matrix34 &world2Object, const Matrix34 &object2World, const Matrix34 &object2WorldNormals) :
         m_material{ material },
@@ -121,17 +248,56 @@ public:
     {}
 
     const Material &material() const { return m_material; }
+    PrimitiveType primitiveType() const { return static_cast<PrimitiveType>(m_object.index()); }
+    BoundingBox bounds() const {
+        return std::visit([] (const auto &obj) { return obj.bounds(); }, m_object);
+    }
     std::optional<Intersection> intersect(const Ray &ray, scalar max_distance) const {
-        return std::visit([&ray, max_distance] (const auto &obj) { return obj.intersect(ray, max_distance); }, m_object);
+        u64 juliaMarchSteps = 0;
+        return intersect(ray, max_distance, juliaMarchSteps);
+    }
+    // juliaMarchSteps gets increased by the sphere tracing steps of julia sets
+    std::optional<Intersection> intersect(const Ray &ray, scalar max_distance, u64 &juliaMarchSteps) const {
+        if (m_motion && ray.time() != 0.0f) {
+            return intersectMoving(ray, max_distance, juliaMarchSteps);
+        }
+        return std::visit([&ray, max_distance, &juliaMarchSteps] (const auto &obj) {
+            return intersect(obj, ray, max_distance, juliaMarchSteps);
+        }, m_object);
     }
 
+    // Motion blur with time sampled rays: the object moves from its state at ray time 0
+    //   to the state of close at ray time 1. Objects at the same place in close stay static.
+    //   Spheres and julia sets interpolate their transformation (see TransformationMotion),
+    //   the world coordinates of the triangle vertices move linearly.
+    void setMotion(const Object &close);
+    bool moving() const { return m_motion != nullptr; }
+
     void addPhoton(u32 textureSize, Point2 pos, Radiance rad);
     Radiance getPhoton(Point2 pos) const;
 
 private:
+    using Primitive = std::variant<Sphere, Triangle, Julia>;
+
+    template <typename T>
+    static std::optional<Intersection> intersect(const T &obj, const Ray &ray, scalar max_distance, u64 &juliaMarchSteps) {
+        if constexpr (std::is_same_v<T, Julia>) {
+            return obj.intersect(ray, max_distance, juliaMarchSteps);
+        } else {
+            return obj.intersect(ray, max_distance);
+        }
+    }
+    std::optional<Intersection> intersectMoving(const Ray &ray, scalar max_distance, u64 &juliaMarchSteps) const;
+
     Material m_material;
     Picture m_photonMap;
-    std::variant<Sphere, Triangle, Julia> m_object;
+    Primitive m_object;
+    struct Motion {
+        Primitive close; // state at the end of the motion
+        std::optional<TransformationMotion> transformation; // of spheres and julia sets
+    };
+    // see setMotion(), shared between copies, nullptr for static objects
+    std::shared_ptr<const Motion> m_motion;
 };
 
 // TODO: optionally spot_light
@@ -171,7 +337,9 @@ public:
     Matrix34 cameraTransformation() const { return m_cameraTransformation; }
     UDim2 resolution() const { return m_resolution; }
     u32 maxBounces() const { return m_maxBounces; }
-    u32 superSamplingPerAxis() const { return m_superSamplingPerAxis; }
+    scalar minRayWeight() const { return m_minRayWeight; }
+    u32 samplesPerPixel() const { return m_samplesPerPixel; }
+    SamplePattern samplePattern() const { return m_samplePattern; }
     scalar focusDistance() const { return m_focusDistance; }
     scalar lensSize() const { return m_lensSize; }
 
@@ -181,7 +349,8 @@ public:
     void setFieldOfViewAngle(scalar fov) { m_fieldOfViewAngle = fov; } // in rad
     void setResolution(UDim2 resolution) { m_resolution = resolution; }
     void setMaxBounces(u32 n) { m_maxBounces = n; }
-    void setSuperSamplingPerAxis(u32 v) { m_superSamplingPerAxis = v; }
+    void setMinRayWeight(scalar weight) { m_minRayWeight = weight; }
+    void setSampling(SamplePattern pattern, u32 samplesPerPixel) { m_samplePattern = pattern; m_samplesPerPixel = samplesPerPixel; }
     void setFocusPoint(Point3 p) { m_focusPoint = p; recalculateCamera(); }
     void setLensSize(scalar size) { m_lensSize = size; }
 
@@ -197,7 +366,9 @@ private:
     scalar m_fieldOfViewAngle{ PI / 4 };
     UDim2 m_resolution{ 512, 512 };
     u32 m_maxBounces{ 8 };
-    u32 m_superSamplingPerAxis{ 1 };
+    scalar m_minRayWeight{ 0.0f }; // reflection/refraction rays contributing less get culled, 0 traces all
+    u32 m_samplesPerPixel{ 1 };
+    SamplePattern m_samplePattern{ SamplePattern::Grid };
     Matrix34 m_cameraTransformation;
     Point3 m_focusPoint{ 0.0f, 0.0f, -1.0f };
     scalar m_focusDistance;
@@ -0,0 +1,9 @@
+#pragma once
+#include <ostream>
+
+#include "types.h"
+
+// Portable Float Map: uncompressed 32 bit float RGB image for HDR output.
+// The radiance values are written unclamped, so the exposure can be adjusted later.
+// The alpha channel is not supported by the format and gets dropped.
+void writePFM(std::ostream &out, const Picture &pic, scalar gain = 1.0f);
@@ -0,0 +1,42 @@
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pfm.h"
+
+// append a float in little endian byte order
+static u8 *writeLittleEndian(u8 *out, float value) {
+    u32 bits;
+    static_assert(sizeof bits == sizeof value, "float must have 32 bits");
+    std::memcpy(&bits, &value, sizeof bits);
+    for (int i = 0; i < 4; i++) {
+        *out++ = static_cast<u8>((bits >> (8 * i)) & 0xff);
+    }
+    return out;
+}
+
+void writePFM(std::ostream &out, const Picture &pic, scalar gain) {
+    const UDim2 size = pic.size();
+    // "PF" = RGB color, the negative scale marks little endian data
+    out << "PF\n" << size.x << " " << size.y << "\n-1.0\n";
+
+    // the lines are stored from bottom to top,
+    // every line is converted directly from the framebuffer
+    std::vector<Radiance> line(size.x);
+    std::vector<u8> bytes(static_cast<size_t>(size.x) * 3 * sizeof(float));
+    for (u32 y = size.y; y-- > 0;) {
+        pic.getLine(y, gain, line.data());
+        u8 *it = bytes.data();
+        for (const Radiance &radiance : line) {
+            it = writeLittleEndian(it, radiance.r);
+            it = writeLittleEndian(it, radiance.g);
+            it = writeLittleEndian(it, radiance.b);
+        }
+        out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+    if (!out) {
+        throw std::runtime_error("PFM file could not be written");
+    }
+}
@@ -13,8 +13,10 @@
 // As this is a copy of raytracer.cpp it also contains code parts from
 //   https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
 
-void PhotonMapper::generate(Scene &scene) {
-    PhotonMapper(scene).generate();
+u64 PhotonMapper::generate(Scene &scene) {
+    PhotonMapper photonMapper(scene);
+    photonMapper.generate();
+    return photonMapper.m_photons;
 }
 
 void PhotonMapper::generate() {
@@ -64,7 +66,7 @@ void PhotonMapper::castRay(const Ray &ray, u32 recursion, scalar wavelength, Rad
     }
     scalar max_distance = INFINITE;
     Object *nearestObject = nullptr;
-    Intersection nearestIntersection;
+    Intersection nearestIntersection{};
     for (Object &object : m_scene.objects()) {
         if (const auto intersection = object.intersect(ray, max_distance)) {
             max_distance = intersection->distance;
@@ -80,6 +82,7 @@ void PhotonMapper::castRay(const Ray &ray, u32 recursion, scalar wavelength, Rad
         // the lightray ends here, store it
         if (recursion > 0) {
             nearestObject->addPhoton(m_scene.photonMapTextureSize(), nearestIntersection.photonCoordinate, rad);
+            m_photons++;
         }
 
     } else {
@@ -4,7 +4,8 @@
 
 class PhotonMapper {
 public:
-    static void generate(Scene &scene);
+    // returns the number of photons stored
+    static u64 generate(Scene &scene);
 
 private:
     PhotonMapper(Scene &scene) : m_scene{ scene } {}
@@ -13,4 +14,5 @@ private:
     void castRay(const Ray &ray, u32 recursion, scalar wavelength, Radiance rad);
 
     Scene &m_scene;
+    u64 m_photons = 0;
 };
@@ -1,19 +1,83 @@
 #pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <istream>
+#include <mutex>
 #include <ostream>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "texture.h"
 #include "types.h"
 
 enum class PNGFilterType {
     None = 0,
-    Sub = 1
+    Sub = 1,
+    Up = 2,
+    Average = 3,
+    Paeth = 4,
+    Adaptive = 5 // selects the best of the above for every line
 };
 
-void writePNG(std::ostream &out, const Picture &pic, scalar gain = 1.0f, PNGFilterType filterType = PNGFilterType::Sub);
+struct PNGOptions {
+    PNGFilterType filterType = PNGFilterType::Adaptive;
+    int compressionLevel = 6; // zlib compression level 0 (none) .. 9 (best)
+    u32 threads = 1; // threads filtering and compressing bands of lines in parallel
+};
+
+void writePNG(std::ostream &out, const Picture &pic, scalar gain = 1.0f, const PNGOptions &options = {});
 
 void writeAPNGStart(std::ostream &out, UDim2 size, u32 frameCount);
-void writeAPNGFrame(std::ostream &out, const Picture &picture, u32 frameNum, scalar fps, scalar gain = 1.0f, PNGFilterType filterType = PNGFilterType::Sub);
+void writeAPNGFrame(std::ostream &out, const Picture &picture, u32 frameNum, scalar fps, scalar gain = 1.0f, const PNGOptions &options = {});
 void writeAPNGEnd(std::ostream &out);
+// Writes a frame encoded by writeAPNGFrame() (maybe by another process) as frame frameNum.
+//   The fcTL and fdAT chunks get renumbered starting at sequenceNumber, which is advanced.
+//   Frame 0 gets IDAT chunks, all other frames fdAT chunks.
+void writeAPNGFrameData(std::ostream &out, const std::string &frameData, u32 frameNum, u32 &sequenceNumber);
+
+// Encodes and writes APNG frames in a background thread, so the next frame can be rendered meanwhile.
+// At most maxQueuedFrames pictures wait for encoding, addFrame() blocks while the queue is full.
+class APNGFrameWriter {
+public:
+    // receives the encoded data of each frame instead of writing it into a stream
+    using FrameSink = std::function<void(u32 frameNum, const std::string &frameData)>;
+
+    APNGFrameWriter(std::ostream &out, u32 maxQueuedFrames, scalar gain = 1.0f, const PNGOptions &options = {});
+    APNGFrameWriter(FrameSink sink, u32 maxQueuedFrames, scalar gain = 1.0f, const PNGOptions &options = {});
+    ~APNGFrameWriter();
+
+    // throws the error of a previous failed frame
+    void addFrame(Picture picture, u32 frameNum, scalar fps);
+    // waits until all frames are written, throws the error of a failed frame
+    void finish();
+    // time spent in the writer thread encoding and writing frames, complete after finish()
+    double encodeSeconds() const { return m_encodeSeconds; }
+
+private:
+    struct Frame {
+        Picture picture;
+        u32 frameNum;
+        scalar fps;
+    };
+
+    void run();
+    void throwError();
+
+    std::ostream *const m_out;
+    const FrameSink m_sink;
+    const u32 m_maxQueuedFrames;
+    const scalar m_gain;
+    const PNGOptions m_options;
+    std::mutex m_mutex;
+    std::condition_variable m_queueChanged;
+    std::deque<Frame> m_queue;
+    bool m_finished = false;
+    std::exception_ptr m_error;
+    double m_encodeSeconds = 0.0;
+    std::thread m_thread;
+};
 
-Picture readPNG(std::istream &inStream);
+Texture readPNG(std::istream &inStream);
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <array>
+#include <cstdlib>
 #include <exception>
 #include <istream>
 #include <iterator>
@@ -13,6 +14,8 @@
 
 static const std::array<u8, 8> PNGHeader = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
 static const std::array<u8, 4> IHDRTag{ 0x49, 0x48, 0x44, 0x52 };
+static const std::array<u8, 4> PLTETag{ 0x50, 0x4c, 0x54, 0x45 };
+static const std::array<u8, 4> tRNSTag{ 0x74, 0x52, 0x4e, 0x53 };
 static const std::array<u8, 4> IDATTag{ 0x49, 0x44, 0x41, 0x54 };
 static const std::array<u8, 4> IENDTag{ 0x49, 0x45, 0x4e, 0x44 };
 
@@ -22,6 +25,14 @@ enum class ReadState {
     End
 };
 
+enum ColorType : u8 {
+    Grayscale = 0,
+    Truecolor = 2,
+    Indexed = 3,
+    GrayscaleAlpha = 4,
+    TruecolorAlpha = 6
+};
+
 struct PngIHDR {
     u32 width;
     u32 height;
@@ -30,12 +41,44 @@ struct PngIHDR {
     u8 compressionMethod;
     u8 filterMethod;
     u8 interlaceMethod;
+
+    u32 channels() const {
+        switch (colorType) {
+        case Truecolor:
+            return 3;
+        case GrayscaleAlpha:
+            return 2;
+        case TruecolorAlpha:
+            return 4;
+        default:
+            return 1;
+        }
+    }
+    // bytes of a line of the given width (without filter type byte)
+    size_t lineSize(u32 lineWidth) const { return (static_cast<size_t>(lineWidth) * channels() * bitDepth + 7) / 8; }
+    // distance of the bytes compared by the filters
+    size_t filterDistance() const { return std::max<size_t>(1, channels() * bitDepth / 8); }
 };
 
-PngIHDR readPngIHDR(BinaryInputStream &in, size_t chunkLen);
-Picture decodePngData(const PngIHDR &ihdr, const std::vector<u8> &data);
+// optional palette and transparency information
+struct PngColors {
+    std::vector<UColor> palette;
+    std::vector<u8> transparency; // alpha per palette entry
+    std::array<u16, 3> transparentColor; // the fully transparent color for gray / truecolor images
+    bool hasTransparentColor = false;
+};
 
-Picture readPNG(std::istream &inStream)
+// Reduced image of one Adam7 interlace pass (or the whole image without interlacing)
+struct PngPass {
+    u32 xStart, yStart, xStep, yStep;
+    u32 width, height;
+};
+
+static PngIHDR readPngIHDR(BinaryInputStream &in, size_t chunkLen);
+static std::vector<PngPass> getPasses(const PngIHDR &ihdr);
+static Texture decodePngData(const PngIHDR &ihdr, const PngColors &colors, std::vector<u8> &data);
+
+Texture readPNG(std::istream &inStream)
 {
     BinaryInputStream in(inStream);
 
@@ -45,7 +88,21 @@ Picture readPNG(std::istream &inStream)
 
     ReadState state = ReadState::Header;
     PngIHDR ihdr;
-    std::vector<u8> compressedData;
+    PngColors colors;
+    // the data is inflated chunk by chunk while reading
+    std::vector<u8> chunkData;
+    std::vector<u8> imageData;
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        throw std::runtime_error("png uncompress: init failed");
+    }
+    // make sure the z_stream gets freed on all exceptions
+    struct InflateEnd {
+        z_stream &stream;
+        ~InflateEnd() { inflateEnd(&stream); }
+    } inflateEndGuard{ stream };
+    bool streamEnd = false;
+
     while (state != ReadState::End) {
         u32 chunkLen = in.read<u32>();
         in.getAndResetCRC();
@@ -56,14 +113,71 @@ Picture readPNG(std::istream &inStream)
             if (state != ReadState::Header) {
                 throw std::runtime_error("unexpected PNG IHDR chunk");
             }
-            ihdr = readPngIHDR(in, chunkLen);            
+            ihdr = readPngIHDR(in, chunkLen);
+            // Calculate the uncompressed data size:
+            // 1 additional byte per line (for filter type)
+            const std::vector<PngPass> passes = getPasses(ihdr);
+            const size_t imageDataSize = std::accumulate(passes.begin(), passes.end(), size_t{ 0 }, [&ihdr] (size_t sum, const PngPass &pass) {
+                return sum + (pass.width == 0 ? 0 : pass.height * (ihdr.lineSize(pass.width) + 1));
+            });
+            imageData.resize(imageDataSize);
+            stream.next_out = imageData.data();
+            stream.avail_out = static_cast<uInt>(imageData.size());
             state = ReadState::Data;
 
+        } else if (chunkType == PLTETag) {
+            if (state != ReadState::Data || chunkLen % 3 != 0 || chunkLen / 3 > 256) {
+                throw std::runtime_error("unexpected PNG PLTE chunk");
+            }
+            chunkData.resize(chunkLen);
+            in.readBlock(chunkData.data(), chunkLen);
+            colors.palette.clear();
+            for (size_t i = 0; i < chunkLen; i += 3) {
+                colors.palette.push_back(UColor{ chunkData[i], chunkData[i + 1], chunkData[i + 2], 255u });
+            }
+
+        } else if (chunkType == tRNSTag) {
+            if (state != ReadState::Data) {
+                throw std::runtime_error("unexpected PNG tRNS chunk");
+            }
+            chunkData.resize(chunkLen);
+            in.readBlock(chunkData.data(), chunkLen);
+            if (ihdr.colorType == Indexed) {
+                colors.transparency = chunkData;
+            } else if ((ihdr.colorType == Grayscale && chunkLen == 2) || (ihdr.colorType == Truecolor && chunkLen == 6)) {
+                for (size_t i = 0; i < chunkLen / 2; i++) {
+                    colors.transparentColor[i] = static_cast<u16>(chunkData[2 * i] << 8 | chunkData[2 * i + 1]);
+                }
+                colors.hasTransparentColor = true;
+            }
+
         } else if (chunkType == IDATTag) {
             if (state != ReadState::Data) {
                 throw std::runtime_error("unexpected PNG IDAT chunk");
             }
-            in.read(std::back_inserter(compressedData), chunkLen);
+            chunkData.resize(chunkLen);
+            in.readBlock(chunkData.data(), chunkLen);
+            stream.next_in = chunkData.data();
+            stream.avail_in = chunkLen;
+            while (stream.avail_in > 0 && !streamEnd) {
+                const int ret = inflate(&stream, Z_NO_FLUSH);
+                switch (ret) {
+                case Z_OK:
+                    if (stream.avail_out == 0 && stream.avail_in > 0) {
+                        throw std::runtime_error("png uncompress: more data than expected");
+                    }
+                    break;
+                case Z_STREAM_END:
+                    streamEnd = true;
+                    break;
+                case Z_MEM_ERROR:
+                    throw std::runtime_error("png uncompress: out of memory");
+                case Z_DATA_ERROR:
+                    throw std::runtime_error("png uncompress: data corrupted");
+                default:
+                    throw std::runtime_error("png uncompress: unknown error");
+                }
+            }
 
         } else if (chunkType == IENDTag) {
             if (state != ReadState::Data) {
@@ -78,7 +192,7 @@ Picture readPNG(std::istream &inStream)
             // skip unknown PNG chunks
             in.advance(chunkLen);
         }
-        
+
         u32 calcChecksum = in.getAndResetCRC();
         u32 checksum = in.read<u32>();
         if (calcChecksum != checksum) {
@@ -86,32 +200,17 @@ Picture readPNG(std::istream &inStream)
         }
     }
 
-    // Calculate the uncompressed data size
-    // 3 (RGB) or 4 (RGBA) bytes per pixel
-    // 1 additional byte per line (for filter type)
-    size_t imageDataSize = static_cast<size_t>(ihdr.width) * ihdr.height * (ihdr.colorType == 2 ? 3 : 4) + ihdr.height;
-    std::vector<u8> imageData(imageDataSize);
-    
-    uLong imageDataLen = static_cast<uLong>(imageDataSize);
-    int ret = uncompress(imageData.data(), &imageDataLen, compressedData.data(), static_cast<uLong>(compressedData.size()));
-    if (ret != Z_OK) {
-        switch (ret) {
-        case Z_MEM_ERROR:
-            throw std::runtime_error("png uncompress: out of memory");
-        case Z_BUF_ERROR:
-            throw std::runtime_error("png uncompress: not enough memory reservered");
-        case Z_DATA_ERROR:
-            throw std::runtime_error("png uncompress: data corrupted");
-        default:
-            throw std::runtime_error("png uncompress: unknown error");
-        }
+    if (!streamEnd || stream.avail_out != 0) {
+        throw std::runtime_error("png uncompress: data incomplete");
+    }
+    if (ihdr.colorType == Indexed && colors.palette.empty()) {
+        throw std::runtime_error("PNG palette missing");
     }
-    compressedData.clear();
 
-    return decodePngData(ihdr, imageData);
+    return decodePngData(ihdr, colors, imageData);
 }
 
-PngIHDR readPngIHDR(BinaryInputStream &in, size_t chunkLen) {
+static PngIHDR readPngIHDR(BinaryInputStream &in, size_t chunkLen) {
     if (chunkLen != 13) {
         throw std::runtime_error("unexpected PNG IHDR chunk length");
     }
@@ -134,21 +233,59 @@ PngIHDR readPngIHDR(BinaryInputStream &in, size_t chunkLen) {
     if (h.filterMethod != 0) {
         throw std::runtime_error("unexpected PNG filter method");
     }
-
-    // check for unsupported formats
-    if (h.bitDepth != 8) {
-        throw std::runtime_error("only PNG with bit depth 8 bits/color supported");
+    if (h.interlaceMethod > 1) {
+        throw std::runtime_error("unexpected PNG interlace method");
     }
-    if (h.colorType != 2 && h.colorType != 6) {
-        throw std::runtime_error("only PNG with truecolor (and optionally alpha) supported");
+
+    // allowed combinations according
+    //   https://www.w3.org/TR/2003/REC-PNG-20031110/#table111
+    bool validBitDepth;
+    switch (h.colorType) {
+    case Grayscale:
+        validBitDepth = h.bitDepth == 1 || h.bitDepth == 2 || h.bitDepth == 4 || h.bitDepth == 8 || h.bitDepth == 16;
+        break;
+    case Indexed:
+        validBitDepth = h.bitDepth == 1 || h.bitDepth == 2 || h.bitDepth == 4 || h.bitDepth == 8;
+        break;
+    case Truecolor:
+    case GrayscaleAlpha:
+    case TruecolorAlpha:
+        validBitDepth = h.bitDepth == 8 || h.bitDepth == 16;
+        break;
+    default:
+        throw std::runtime_error("unexpected PNG color type");
     }
-    if (h.interlaceMethod != 0) {
-        throw std::runtime_error("only non-interlaced PNGs supported");
+    if (!validBitDepth) {
+        throw std::runtime_error("unexpected PNG bit depth");
     }
 
     return h;
 }
 
+static std::vector<PngPass> getPasses(const PngIHDR &ihdr) {
+    if (ihdr.interlaceMethod == 0) {
+        return { PngPass{ 0, 0, 1, 1, ihdr.width, ihdr.height } };
+    }
+    // Adam7 interlacing: 7 passes with reduced images
+    static const std::array<std::array<u32, 4>, 7> adam7{{
+        // xStart, yStart, xStep, yStep
+        { 0, 0, 8, 8 },
+        { 4, 0, 8, 8 },
+        { 0, 4, 4, 8 },
+        { 2, 0, 4, 4 },
+        { 0, 2, 2, 4 },
+        { 1, 0, 2, 2 },
+        { 0, 1, 1, 2 }
+    }};
+    std::vector<PngPass> passes;
+    for (const auto &p : adam7) {
+        const u32 width = ihdr.width > p[0] ? (ihdr.width - p[0] + p[2] - 1) / p[2] : 0;
+        const u32 height = ihdr.height > p[1] ? (ihdr.height - p[1] + p[3] - 1) / p[3] : 0;
+        passes.push_back(PngPass{ p[0], p[1], p[2], p[3], width, height });
+    }
+    return passes;
+}
+
 enum class FilterType {
     None = 0,
     Sub = 1,
@@ -157,82 +294,144 @@ enum class FilterType {
     Paeth = 4
 };
 
-static UColor average(UColor lhs, UColor rhs) {
-    return UColor{
-        static_cast<u8>((lhs.r + rhs.r) / 2),
-        static_cast<u8>((lhs.g + rhs.g) / 2),
-        static_cast<u8>((lhs.b + rhs.b) / 2),
-        static_cast<u8>((lhs.a + rhs.a) / 2)
-    };
-}
-
 // PaethPredictor function as written in the PNG standard:
 // https://www.w3.org/TR/2003/REC-PNG-20031110/#9Filter-type-4-Paeth
+// with p - a, p - b and p - c simplified, so it compiles to conditional moves
 static u8 paeth(u8 a, u8 b, u8 c) {
-    int p = static_cast<int>(a) + b - c;
-    int pa = abs(p - a);
-    int pb = abs(p - b);
-    int pc = abs(p - c);
-    if (pa <= pb && pa <= pc) {
-        return a;
-    } else if (pb <= pc) {
-        return b;
-    } else {
-        return c;
+    const int pa = abs(b - c);
+    const int pb = abs(a - c);
+    const int pc = abs(a + b - 2 * c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Reverse the filter of one line in place. Works on bytes, dist is the distance
+// to the corresponding byte of the previous pixel. The loops have no dependencies
+// between the bytes of one pixel, Up has none at all and gets vectorized.
+static void unfilterLine(FilterType filterType, u8 *line, const u8 *prevLine, size_t len, size_t dist) {
+    switch (filterType) {
+    case FilterType::None:
+        break;
+    case FilterType::Sub:
+        for (size_t i = dist; i < len; i++) {
+            line[i] = static_cast<u8>(line[i] + line[i - dist]);
+        }
+        break;
+    case FilterType::Up:
+        for (size_t i = 0; i < len; i++) {
+            line[i] = static_cast<u8>(line[i] + prevLine[i]);
+        }
+        break;
+    case FilterType::Average:
+        for (size_t i = 0; i < std::min(dist, len); i++) {
+            line[i] = static_cast<u8>(line[i] + prevLine[i] / 2);
+        }
+        for (size_t i = dist; i < len; i++) {
+            line[i] = static_cast<u8>(line[i] + (line[i - dist] + prevLine[i]) / 2);
+        }
+        break;
+    case FilterType::Paeth:
+        for (size_t i = 0; i < std::min(dist, len); i++) {
+            line[i] = static_cast<u8>(line[i] + prevLine[i]);
+        }
+        for (size_t i = dist; i < len; i++) {
+            line[i] = static_cast<u8>(line[i] + paeth(line[i - dist], prevLine[i], prevLine[i - dist]));
+        }
+        break;
+    default:
+        throw std::runtime_error("unsupported PNG filter type");
     }
 }
 
-static UColor paeth(UColor a, UColor b, UColor c) {
-    return UColor{
-        paeth(a.r, b.r, c.r),
-        paeth(a.g, b.g, c.g),
-        paeth(a.b, b.b, c.b),
-        paeth(a.a, b.a, c.a)
-    };
+// get sample number index of a line, samples with less than 8 bits are packed starting with the high bits
+static u16 getSample(const u8 *line, size_t index, u8 bitDepth) {
+    switch (bitDepth) {
+    case 16:
+        return static_cast<u16>(line[2 * index] << 8 | line[2 * index + 1]);
+    case 8:
+        return line[index];
+    default:
+        const size_t bit = index * bitDepth;
+        const u32 shift = 8 - bitDepth - bit % 8;
+        return static_cast<u16>((line[bit / 8] >> shift) & ((1u << bitDepth) - 1));
+    }
 }
 
-Picture decodePngData(const PngIHDR &ihdr, const std::vector<u8> &data) {
-    const bool alpha = ihdr.colorType == 6;
-    Picture pic({ ihdr.width, ihdr.height });
-    auto it = data.begin();
-
-    std::vector<UColor> prevLine(ihdr.width, { 0, 0, 0, 0 });
-    for (u32 y = 0; y < ihdr.height; y++) {
-        FilterType filterType = static_cast<FilterType>(*it++);
-
-        UColor prevPixel{ 0, 0, 0, 0 };
-        UColor prevLinePixel{ 0, 0, 0, 0 };
-        UColor prevLinePrevPixel{ 0, 0, 0, 0 };
-        for (u32 x = 0; x < ihdr.width; x++) {
-            prevLinePrevPixel = prevLinePixel;
-            prevLinePixel = prevLine[x];
-            UColor col{ *it++, *it++ , *it++, alpha ? *it++ : u8(255u) };
-
-            switch (filterType) {
-            case FilterType::None:
-                break;
-            case FilterType::Sub:
-                col = col + prevPixel;
-                break;
-            case FilterType::Up:
-                col = col + prevLinePixel;
-                break;
-            case FilterType::Average:
-                col = col + average(prevPixel, prevLinePixel);
-                break;
-            case FilterType::Paeth:
-                col = col + paeth(prevPixel, prevLinePixel, prevLinePrevPixel);
-                break;
-            default:
-                throw std::runtime_error("unsupported PNG filter type");
-            }
-            if (!alpha) {
-                col.a = 255u;
+// scale a sample to 8 bits (16 bit samples lose their lower byte)
+static u8 scaleSample(u16 sample, u8 bitDepth) {
+    switch (bitDepth) {
+    case 16:
+        return static_cast<u8>(sample >> 8);
+    case 8:
+        return static_cast<u8>(sample);
+    default:
+        return static_cast<u8>(sample * 255u / ((1u << bitDepth) - 1));
+    }
+}
+
+static UColor getColor(const PngIHDR &ihdr, const PngColors &colors, const u8 *line, u32 x) {
+    const u32 channels = ihdr.channels();
+    const u8 bitDepth = ihdr.bitDepth;
+    std::array<u16, 4> samples{};
+    for (u32 c = 0; c < channels; c++) {
+        samples[c] = getSample(line, static_cast<size_t>(x) * channels + c, bitDepth);
+    }
+    switch (ihdr.colorType) {
+    case Grayscale: {
+        const u8 gray = scaleSample(samples[0], bitDepth);
+        const bool transparent = colors.hasTransparentColor && samples[0] == colors.transparentColor[0];
+        return UColor{ gray, gray, gray, transparent ? u8(0u) : u8(255u) };
+    }
+    case Truecolor: {
+        const bool transparent = colors.hasTransparentColor && samples[0] == colors.transparentColor[0] &&
+            samples[1] == colors.transparentColor[1] && samples[2] == colors.transparentColor[2];
+        return UColor{ scaleSample(samples[0], bitDepth), scaleSample(samples[1], bitDepth), scaleSample(samples[2], bitDepth),
+            transparent ? u8(0u) : u8(255u) };
+    }
+    case Indexed: {
+        if (samples[0] >= colors.palette.size()) {
+            throw std::runtime_error("PNG palette index out of range");
+        }
+        UColor color = colors.palette[samples[0]];
+        if (samples[0] < colors.transparency.size()) {
+            color.a = colors.transparency[samples[0]];
+        }
+        return color;
+    }
+    case GrayscaleAlpha: {
+        const u8 gray = scaleSample(samples[0], bitDepth);
+        return UColor{ gray, gray, gray, scaleSample(samples[1], bitDepth) };
+    }
+    default:
+        return UColor{ scaleSample(samples[0], bitDepth), scaleSample(samples[1], bitDepth), scaleSample(samples[2], bitDepth),
+            scaleSample(samples[3], bitDepth) };
+    }
+}
+
+static Texture decodePngData(const PngIHDR &ihdr, const PngColors &colors, std::vector<u8> &data) {
+    std::vector<UColor> texels(static_cast<size_t>(ihdr.width) * ihdr.height);
+    const size_t dist = ihdr.filterDistance();
+    u8 *it = data.data();
+
+    for (const PngPass &pass : getPasses(ihdr)) {
+        if (pass.width == 0) {
+            // empty passes have no filter bytes
+            continue;
+        }
+        const size_t lineSize = ihdr.lineSize(pass.width);
+        const std::vector<u8> zeroLine(lineSize, 0);
+        const u8 *prevLine = zeroLine.data();
+        for (u32 y = 0; y < pass.height; y++) {
+            const FilterType filterType = static_cast<FilterType>(*it++);
+            u8 *line = it;
+            unfilterLine(filterType, line, prevLine, lineSize, dist);
+            const size_t texelLine = static_cast<size_t>(pass.yStart + y * pass.yStep) * ihdr.width;
+            for (u32 x = 0; x < pass.width; x++) {
+                texels[texelLine + pass.xStart + x * pass.xStep] = getColor(ihdr, colors, line, x);
             }
-            pic.set({ x, y }, col);
-            prevLine[x] = prevPixel = col;
+            prevLine = line;
+            it += lineSize;
         }
     }
 
-    return pic;
+    return Texture({ ihdr.width, ihdr.height }, texels);
 }
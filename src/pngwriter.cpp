@@ -1,9 +1,18 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <future>
 #include <iterator>
+#include <limits>
+#include <optional>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <zlib.h>
 
@@ -157,6 +166,7 @@ struct APNGFrameControl {
     APNGFrameControl(u32 width, u32 height, u32 seqNum, scalar fps) : fctl{ width, height, seqNum, fps } {}
 };
 
+static const u8 APNGControlTag[] = { 0x66, 0x63, 0x54, 0x4c }; // fcTL
 static const u8 PNGDataTag[] = { 0x49, 0x44, 0x41, 0x54 }; // IDAT
 static const u8 APNGDataTag[] = { 0x66, 0x64, 0x41, 0x54 }; // fdAT
 static const u8 PNGFooterTag[] = {
@@ -167,10 +177,195 @@ static const u8 PNGFooterTag[] = {
 #pragma pack(pop)
 
 static const u32 USE_PNG_MODE = std::numeric_limits<u32>::max();
+// The picture gets compressed in bands of lines. The bands are compressed in parallel
+//   as independent raw deflate streams (like pigz), each one ending with a sync flush
+//   on a byte boundary, so they can simply be concatenated. Each band gets its own data chunk.
+static const u32 PNG_BAND_LINES = 128;
+static const size_t DEFLATE_WINDOW_SIZE = 32768;
 
-void writePNG(std::ostream &out, const Picture &picture, scalar gain, PNGFilterType filterType) {    
+static u32 bandCount(UDim2 size) {
+    return (size.y + PNG_BAND_LINES - 1) / PNG_BAND_LINES;
+}
+
+// Sequence number of the fcTL chunk of a frame,
+// it is followed by one fdAT chunk per band (frame 0 uses IDAT chunks without sequence numbers)
+static u32 frameSequenceNumber(u32 frameNum, u32 bands) {
+    return frameNum == 0 ? 0 : (frameNum - 1) * (bands + 1) + 1;
+}
+
+// Run function(0..count-1) on up to threads threads
+template <typename Function>
+static void runParallel(u32 count, u32 threads, Function function) {
+    std::atomic<u32> next{ 0 };
+    auto worker = [&next, count, &function] {
+        u32 i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            function(i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (u32 i = 1; i < std::min(threads, count); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    std::for_each(workers.begin(), workers.end(), [] (std::thread &t) { t.join(); });
+}
+
+// PaethPredictor function as written in the PNG standard:
+// https://www.w3.org/TR/2003/REC-PNG-20031110/#9Filter-type-4-Paeth
+static u8 paeth(u8 a, u8 b, u8 c) {
+    int p = static_cast<int>(a) + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    } else if (pb <= pc) {
+        return b;
+    } else {
+        return c;
+    }
+}
+
+// Filter one line of RGBA bytes, prevLine is all 0 for the first line
+static void filterLine(PNGFilterType filterType, const u8 *line, const u8 *prevLine, size_t len, u8 *out) {
+    const size_t bpp = 4;
+    for (size_t i = 0; i < len; i++) {
+        const u8 a = i >= bpp ? line[i - bpp] : 0;
+        const u8 b = prevLine[i];
+        const u8 c = i >= bpp ? prevLine[i - bpp] : 0;
+        switch (filterType) {
+        case PNGFilterType::None:
+            out[i] = line[i];
+            break;
+        case PNGFilterType::Sub:
+            out[i] = static_cast<u8>(line[i] - a);
+            break;
+        case PNGFilterType::Up:
+            out[i] = static_cast<u8>(line[i] - b);
+            break;
+        case PNGFilterType::Average:
+            out[i] = static_cast<u8>(line[i] - (a + b) / 2);
+            break;
+        default:
+            out[i] = static_cast<u8>(line[i] - paeth(a, b, c));
+            break;
+        }
+    }
+}
+
+// Adaptive filtering: use the filter with the minimum sum of absolute differences,
+//   the heuristic recommended by the PNG standard.
+static void filterLineAdaptive(const u8 *line, const u8 *prevLine, size_t len, u8 *out, std::vector<u8> &tmp) {
+    u64 bestSum = std::numeric_limits<u64>::max();
+    tmp.resize(len);
+    for (PNGFilterType filterType : { PNGFilterType::None, PNGFilterType::Sub, PNGFilterType::Up, PNGFilterType::Average, PNGFilterType::Paeth }) {
+        filterLine(filterType, line, prevLine, len, tmp.data());
+        u64 sum = 0;
+        for (u8 v : tmp) {
+            sum += static_cast<u64>(std::abs(static_cast<int>(static_cast<signed char>(v))));
+        }
+        if (sum < bestSum) {
+            bestSum = sum;
+            out[-1] = static_cast<u8>(filterType);
+            std::copy(tmp.begin(), tmp.end(), out);
+        }
+    }
+}
+
+// Filter all lines of a band into their place in filteredData
+static void filterBand(const Picture &picture, scalar gain, PNGFilterType filterType, u32 band, std::vector<u8> &filteredData) {
+    const UDim2 size = picture.size();
+    const size_t lineLen = static_cast<size_t>(size.x) * 4;
+    std::vector<UColor> colors(size.x);
+    std::vector<u8> line(lineLen), prevLine(lineLen, 0), tmp;
+    auto toBytes = [&picture, gain, &colors] (u32 y, std::vector<u8> &bytes) {
+        picture.scaleOutLine(y, gain, colors.data());
+        for (size_t x = 0; x < colors.size(); x++) {
+            const auto rgba = colors[x].rgba();
+            std::copy(rgba.begin(), rgba.end(), &bytes[x * 4]);
+        }
+    };
+    const u32 startY = band * PNG_BAND_LINES;
+    const u32 endY = std::min(startY + PNG_BAND_LINES, size.y);
+    if (startY > 0) {
+        toBytes(startY - 1, prevLine);
+    }
+    for (u32 y = startY; y < endY; y++) {
+        toBytes(y, line);
+        u8 *out = &filteredData[y * (lineLen + 1)];
+        if (filterType == PNGFilterType::Adaptive) {
+            filterLineAdaptive(line.data(), prevLine.data(), lineLen, out + 1, tmp);
+        } else {
+            out[0] = static_cast<u8>(filterType);
+            filterLine(filterType, line.data(), prevLine.data(), lineLen, out + 1);
+        }
+        std::swap(line, prevLine);
+    }
+}
+
+// Compress a band as raw deflate data. It uses the preceding data as dictionary
+//   to compress nearly as good as a single stream.
+static std::vector<u8> compressBand(const u8 *data, size_t len, const u8 *dictionaryEnd, size_t dictionaryLen, int level, bool last) {
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("zlib compression init failed");
+    }
+    if (dictionaryLen > 0) {
+        deflateSetDictionary(&stream, dictionaryEnd - dictionaryLen, static_cast<uInt>(dictionaryLen));
+    }
+    // space for the sync flush marker
+    std::vector<u8> compressed(deflateBound(&stream, static_cast<uLong>(len)) + 16);
+    stream.next_in = const_cast<u8 *>(data);
+    stream.avail_in = static_cast<uInt>(len);
+    stream.next_out = compressed.data();
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    const int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    const bool ok = last ? ret == Z_STREAM_END : ret == Z_OK && stream.avail_in == 0 && stream.avail_out > 0;
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (!ok) {
+        throw std::runtime_error("zlib compression failed");
+    }
+    return compressed;
+}
+
+// zlib stream header with the compression level hint, see RFC 1950
+static std::array<u8, 2> zlibHeader(int level) {
+    const u8 cmf = 0x78; // deflate with 32K window
+    const u8 levelHint = level < 0 || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+    u8 flg = static_cast<u8>(levelHint << 6);
+    flg = static_cast<u8>(flg + 31 - (cmf * 256 + flg) % 31);
+    return { cmf, flg };
+}
+
+static void writeChunk(std::ostream &out, const u8 *tag, std::optional<u32> sequenceNumber,
+    const u8 *prefix, size_t prefixLen, const std::vector<u8> &data, const u8 *suffix, size_t suffixLen) {
+    const u32net seq = toNet32(sequenceNumber.value_or(0));
+    const size_t seqLen = sequenceNumber ? seq.size() : 0;
+    out << toNet32(static_cast<u32>(seqLen + prefixLen + data.size() + suffixLen));
+    out.write(reinterpret_cast<const char *>(tag), 4);
+    out.write(reinterpret_cast<const char *>(seq.data()), seqLen);
+    out.write(reinterpret_cast<const char *>(prefix), prefixLen);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+    out.write(reinterpret_cast<const char *>(suffix), suffixLen);
+    uLong crc = crc32(Z_NULL, tag, 4);
+    // crc32() with a null pointer returns the initial value, so empty parts are skipped
+    auto updateCrc = [&crc] (const u8 *part, size_t len) {
+        if (len > 0) {
+            crc = crc32(crc, part, static_cast<uInt>(len));
+        }
+    };
+    updateCrc(seq.data(), seqLen);
+    updateCrc(prefix, prefixLen);
+    updateCrc(data.data(), data.size());
+    updateCrc(suffix, suffixLen);
+    out << toNet32(static_cast<u32>(crc));
+}
+
+void writePNG(std::ostream &out, const Picture &picture, scalar gain, const PNGOptions &options) {
     writeAPNGStart(out, picture.size(), USE_PNG_MODE);
-    writeAPNGFrame(out, picture, USE_PNG_MODE, 1.0f, gain, filterType);
+    writeAPNGFrame(out, picture, USE_PNG_MODE, 1.0f, gain, options);
     writeAPNGEnd(out);
 }
 
@@ -191,49 +386,201 @@ void writeAPNGStart(std::ostream &out, UDim2 size, u32 frameCount) {
     }
 }
 
-void writeAPNGFrame(std::ostream &out, const Picture &picture, u32 frameNum, scalar fps, scalar gain, PNGFilterType filterType) {
-    assert(filterType == PNGFilterType::None || filterType == PNGFilterType::Sub);
-    auto size = picture.size();
+void writeAPNGFrame(std::ostream &out, const Picture &picture, u32 frameNum, scalar fps, scalar gain, const PNGOptions &options) {
+    const UDim2 size = picture.size();
+    const u32 bands = bandCount(size);
+    const u32 frameSeqNum = frameSequenceNumber(frameNum == USE_PNG_MODE ? 0 : frameNum, bands);
     if (frameNum != USE_PNG_MODE) {
-        const APNGFrameControl controlblock(size.x, size.y, frameNum == 0 ? 0 : frameNum * 2 - 1, fps);
+        const APNGFrameControl controlblock(size.x, size.y, frameSeqNum, fps);
         out.write(reinterpret_cast<const char *>(&controlblock), sizeof controlblock);
     }
 
-    // only supporting filter type 0 and 1 of filter method 0:
-    //  None = 0: encode every pixel as it is
-    //  Sub  = 1: encode difference to previous pixel in line
-    std::vector<u8> filteredData;
-    filteredData.reserve(static_cast<size_t>(size.x) * size.y * 4 + size.y);
-    for (u32 y = 0; y < size.y; y++) {
-        filteredData.push_back(static_cast<u8>(filterType));
-        UColor prevPixelColor{ 0, 0, 0, 0 };
-        for (u32 x = 0; x < size.x; x++) {
-            const UColor color = picture.get({ x, y }).scaleOut(gain);
-            const auto encodedColor = (filterType == PNGFilterType::None ? color : color - prevPixelColor).rgba();
-            filteredData.insert(filteredData.end(), std::begin(encodedColor), std::end(encodedColor));
-            prevPixelColor = color;
-        }
-    }
-
-    bool useAPngDataBlock = frameNum != USE_PNG_MODE && frameNum != 0;
-    const auto &tag = useAPngDataBlock ? APNGDataTag : PNGDataTag;
-    std::vector<u8> compressedData(std::begin(tag), std::end(tag));
-    if (useAPngDataBlock) {
-        const auto frameNumNet = toNet32(frameNum * 2);
-        compressedData.insert(compressedData.end(), std::begin(frameNumNet), std::end(frameNumNet));
-    }
-    unsigned long compressedSize = compressBound(static_cast<uLong>(filteredData.size()));
-    size_t hdrSize = compressedData.size();
-    compressedData.resize(hdrSize + compressedSize);
-    int ret = compress(&compressedData[hdrSize], &compressedSize, filteredData.data(), static_cast<uLong>(filteredData.size()));
-    if (ret != Z_OK) {
-        throw std::runtime_error("zlib compression failed");
+    // 1. filter all bands in parallel, every line starts with its filter type byte
+    const size_t filteredLineLen = static_cast<size_t>(size.x) * 4 + 1;
+    std::vector<u8> filteredData(filteredLineLen * size.y);
+    runParallel(bands, options.threads, [&] (u32 band) {
+        filterBand(picture, gain, options.filterType, band, filteredData);
+    });
+
+    // 2. compress all bands in parallel and write them in order as soon as they are ready
+    struct CompressedBand {
+        std::vector<u8> data;
+        uLong adler;
+        size_t len;
+    };
+    std::vector<std::promise<CompressedBand>> compressedBands(bands);
+    std::vector<std::future<CompressedBand>> futures;
+    std::transform(compressedBands.begin(), compressedBands.end(), std::back_inserter(futures), [] (auto &p) { return p.get_future(); });
+    auto compress = [&] (u32 band) {
+        try {
+            const size_t start = band * PNG_BAND_LINES * filteredLineLen;
+            const size_t end = std::min<size_t>(start + PNG_BAND_LINES * filteredLineLen, filteredData.size());
+            const u8 *data = filteredData.data() + start;
+            std::vector<u8> compressed = compressBand(data, end - start, data, std::min(start, DEFLATE_WINDOW_SIZE),
+                options.compressionLevel, band == bands - 1);
+            compressedBands[band].set_value({ std::move(compressed), adler32(adler32(0, Z_NULL, 0), data, static_cast<uInt>(end - start)), end - start });
+        } catch (...) {
+            compressedBands[band].set_exception(std::current_exception());
+        }
+    };
+    std::thread compressThread{ [&] { runParallel(bands, options.threads, compress); } };
+    try {
+        const bool useAPngDataBlock = frameNum != USE_PNG_MODE && frameNum != 0;
+        const u8 *tag = useAPngDataBlock ? APNGDataTag : PNGDataTag;
+        const std::array<u8, 2> header = zlibHeader(options.compressionLevel);
+        uLong adler = adler32(0, Z_NULL, 0);
+        for (u32 band = 0; band < bands; band++) {
+            const CompressedBand compressed = futures[band].get();
+            adler = adler32_combine(adler, compressed.adler, static_cast<z_off_t>(compressed.len));
+            const u32net trailer = toNet32(static_cast<u32>(adler));
+            const bool last = band == bands - 1;
+            writeChunk(out, tag, useAPngDataBlock ? std::optional<u32>{ frameSeqNum + 1 + band } : std::nullopt,
+                header.data(), band == 0 ? header.size() : 0,
+                compressed.data,
+                trailer.data(), last ? trailer.size() : 0);
+        }
+    } catch (...) {
+        compressThread.join();
+        throw;
+    }
+    compressThread.join();
+}
+
+void writeAPNGFrameData(std::ostream &out, const std::string &frameData, u32 frameNum, u32 &sequenceNumber) {
+    const u8 *data = reinterpret_cast<const u8 *>(frameData.data());
+    const std::vector<u8> noData;
+    size_t pos = 0;
+    while (pos < frameData.size()) {
+        // chunk: length, tag, payload, crc
+        if (frameData.size() - pos < 12) {
+            throw std::runtime_error("broken APNG frame data");
+        }
+        const u8 *chunk = data + pos;
+        const u32 len = static_cast<u32>(chunk[0]) << 24 | chunk[1] << 16 | chunk[2] << 8 | chunk[3];
+        if (frameData.size() - pos - 12 < len) {
+            throw std::runtime_error("broken APNG frame data");
+        }
+        const u8 *tag = chunk + 4;
+        const u8 *payload = chunk + 8;
+        const u8 *crc = payload + len;
+        const u32 calcCrc = static_cast<u32>(crc32(crc32(Z_NULL, tag, 4), payload, len));
+        if (calcCrc != (static_cast<u32>(crc[0]) << 24 | crc[1] << 16 | crc[2] << 8 | crc[3])) {
+            throw std::runtime_error("APNG frame data checksum wrong");
+        }
+
+        const bool isControl = std::equal(tag, tag + 4, APNGControlTag);
+        const bool isAPNGData = std::equal(tag, tag + 4, APNGDataTag);
+        if ((isControl || isAPNGData) && len < 4) {
+            throw std::runtime_error("broken APNG frame data");
+        }
+        // the old sequence number is dropped, the payload is passed as prefix
+        if (isControl) {
+            writeChunk(out, APNGControlTag, sequenceNumber++, payload + 4, len - 4, noData, nullptr, 0);
+        } else if (isAPNGData || std::equal(tag, tag + 4, PNGDataTag)) {
+            const u8 *imageData = isAPNGData ? payload + 4 : payload;
+            const size_t imageDataLen = isAPNGData ? len - 4 : len;
+            if (frameNum == 0) {
+                writeChunk(out, PNGDataTag, std::nullopt, imageData, imageDataLen, noData, nullptr, 0);
+            } else {
+                writeChunk(out, APNGDataTag, sequenceNumber++, imageData, imageDataLen, noData, nullptr, 0);
+            }
+        } else {
+            throw std::runtime_error("unexpected chunk in APNG frame data");
+        }
+        pos += 12 + static_cast<size_t>(len);
+    }
+}
+
+APNGFrameWriter::APNGFrameWriter(std::ostream &out, u32 maxQueuedFrames, scalar gain, const PNGOptions &options) :
+    m_out{ &out },
+    m_maxQueuedFrames{ std::max(maxQueuedFrames, 1u) },
+    m_gain{ gain },
+    m_options{ options },
+    m_thread{ &APNGFrameWriter::run, this }
+{}
+
+APNGFrameWriter::APNGFrameWriter(FrameSink sink, u32 maxQueuedFrames, scalar gain, const PNGOptions &options) :
+    m_out{ nullptr },
+    m_sink{ std::move(sink) },
+    m_maxQueuedFrames{ std::max(maxQueuedFrames, 1u) },
+    m_gain{ gain },
+    m_options{ options },
+    m_thread{ &APNGFrameWriter::run, this }
+{}
+
+APNGFrameWriter::~APNGFrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+    }
+    m_queueChanged.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
     }
-    compressedData.resize(compressedSize + hdrSize);
+}
+
+void APNGFrameWriter::addFrame(Picture picture, u32 frameNum, scalar fps) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // backpressure: wait for the writer thread to catch up
+    m_queueChanged.wait(lock, [this] { return m_queue.size() < m_maxQueuedFrames || m_error; });
+    throwError();
+    m_queue.push_back(Frame{ std::move(picture), frameNum, fps });
+    lock.unlock();
+    m_queueChanged.notify_all();
+}
 
-    out << toNet32(static_cast<u32>(compressedData.size() - 4));
-    out.write(reinterpret_cast<const char *>(compressedData.data()), compressedData.size() * sizeof(u8));
-    out << calcCrc(compressedData.data(), compressedData.size() * sizeof(u8));
+void APNGFrameWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+    }
+    m_queueChanged.notify_all();
+    m_thread.join();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    throwError();
+}
+
+void APNGFrameWriter::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_queueChanged.wait(lock, [this] { return !m_queue.empty() || m_finished; });
+        if (m_queue.empty() || m_error) {
+            // finished, or failed and the remaining frames are dropped
+            return;
+        }
+        Frame &frame = m_queue.front();
+        lock.unlock();
+        const auto beginTime{ std::chrono::steady_clock::now() };
+        try {
+            if (m_sink) {
+                std::ostringstream frameData;
+                writeAPNGFrame(frameData, frame.picture, frame.frameNum, frame.fps, m_gain, m_options);
+                m_sink(frame.frameNum, frameData.str());
+            } else {
+                writeAPNGFrame(*m_out, frame.picture, frame.frameNum, frame.fps, m_gain, m_options);
+                if (!*m_out) {
+                    throw std::runtime_error("writing animation frame failed");
+                }
+            }
+        } catch (...) {
+            lock.lock();
+            m_error = std::current_exception();
+            m_queue.clear();
+            m_queueChanged.notify_all();
+            return;
+        }
+        lock.lock();
+        m_encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+        m_queue.pop_front();
+        m_queueChanged.notify_all();
+    }
+}
+
+// must be called with locked mutex
+void APNGFrameWriter::throwError() {
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
 }
 
 void writeAPNGEnd(std::ostream & out) {
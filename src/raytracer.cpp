@@ -1,35 +1,81 @@
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <complex>
 #include <numeric>
-#include <random>
+#include <optional>
+#include <stdexcept>
 #include <thread>
 
+#include "fresnel.h"
 #include "raytracer.h"
+#include "sampler.h"
 
 // TODO: refactor: remove that instance Instance and make RayTracer::raytrace static or so..
-Picture RayTracer::raytrace(const Scene &scene) const {
+Picture RayTracer::raytrace(const Scene &scene, const std::vector<u32> &tiles) {
     Picture picture(scene.camera().resolution());
-    Instance instance{ *this, scene, picture };
-    instance.raytrace();
+    raytrace(scene, picture, tiles);
     return picture;
 }
 
-RayTracer::Instance::Instance(const RayTracer &raytracer, const Scene &scene, Picture &picture) :
+void RayTracer::raytrace(const Scene &scene, Picture &picture, const std::vector<u32> &tiles, const TileCallback &tileFinished) {
+    const UDim2 resolution = scene.camera().resolution();
+    if (picture.size().x != resolution.x || picture.size().y != resolution.y) {
+        throw std::runtime_error("picture size does not match the camera resolution");
+    }
+    const u32 tileCount = picture.tiles().x * picture.tiles().y;
+    if (std::any_of(tiles.begin(), tiles.end(), [tileCount] (u32 tile) { return tile >= tileCount; })) {
+        throw std::runtime_error("tile number out of range");
+    }
+    m_statistics = Statistics{};
+    if (m_recordPixelCost != PixelCost::None) {
+        m_statistics.pixelCost.resize(resolution.x * resolution.y);
+    }
+    const bool recordStaticPixels = m_animatedBounds && m_staticPixels.empty();
+    if (recordStaticPixels) {
+        // pixels outside of the rendered tiles stay unknown and get rendered later
+        m_staticPixels.resize(resolution.x * resolution.y, 0);
+    } else if (m_staticPixels.size() != resolution.x * resolution.y) {
+        m_staticPixels.clear();
+    }
+    Instance instance{ *this, scene, picture, tiles, tileFinished, recordStaticPixels };
+    instance.raytrace();
+}
+
+RayTracer::Instance::Instance(RayTracer &raytracer, const Scene &scene, Picture &picture, const std::vector<u32> &tiles,
+    const TileCallback &tileFinished, bool recordStaticPixels) :
     m_raytracer{ raytracer },
     m_scene{ scene },
     m_picture{ picture },
+    m_tiles{ tiles },
+    m_tileFinished{ tileFinished },
     m_picSize{ picture.size() },
     m_picSizeF{ m_picSize },
     m_halfFovX{ scene.camera().fieldOfViewAngle() },
     m_halfFov{ -tanf(m_halfFovX), tanf(m_halfFovX) * m_picSizeF.aspect()},
     m_pixelSize{ -2.0f / m_picSizeF * m_halfFov },
-    m_subPixelSize{ m_pixelSize * (1.0f / scene.camera().superSamplingPerAxis()) },
-    m_cameraTransformation{ scene.camera().cameraTransformation() }
+    m_subPixelSize{ m_pixelSize * (1.0f / std::sqrt(static_cast<scalar>(scene.camera().samplesPerPixel()))) },
+    // the area of n * n grid samples with the outer ones on the centers of the neighbour subpixels,
+    //   so 1 sample covers 1 pixel and many samples blend into the neighbour pixels up to 2 pixels wide
+    m_sampleArea{ m_pixelSize * (2.0f * std::sqrt(static_cast<scalar>(scene.camera().samplesPerPixel())) /
+        (std::sqrt(static_cast<scalar>(scene.camera().samplesPerPixel())) + 1.0f)) },
+    m_cameraTransformation{ scene.camera().cameraTransformation() },
+    m_cameraMotion{ scene.camera().cameraTransformation(), scene.closeCamera().cameraTransformation() },
+    m_closeFocusDistance{ scene.closeCamera().focusDistance() },
+    // together the pixel samples get at least as many times as subframes would be rendered
+    m_timeSamples{ scene.moving() ? std::max(1U, (scene.subFrames() + scene.camera().samplesPerPixel() - 1) / scene.camera().samplesPerPixel()) : 1 },
+    m_subPixelSteps{
+        m_cameraTransformation.mulWithoutTranslate(Vector3{ m_subPixelSize.x, 0.0f, 0.0f } * scene.camera().focusDistance()),
+        m_cameraTransformation.mulWithoutTranslate(Vector3{ 0.0f, m_subPixelSize.y, 0.0f } * scene.camera().focusDistance())
+    },
+    m_pixelCost{ raytracer.m_statistics.pixelCost.empty() ? nullptr : raytracer.m_statistics.pixelCost.data() },
+    m_recordAnimatedBounds{ recordStaticPixels ? &*raytracer.m_animatedBounds : nullptr },
+    m_staticPixels{ raytracer.m_staticPixels.empty() ? nullptr : raytracer.m_staticPixels.data() }
 {
 }
 
 void RayTracer::Instance::raytrace() {
-    m_NextLine.store(0, std::memory_order_relaxed);
+    m_nextTile.store(0, std::memory_order_relaxed);
     std::vector <std::thread> threads;
     for (u32 i = 0; i < m_scene.threads(); i++) {
         threads.emplace_back(&Thread::raytrace, Thread{ *this });
@@ -39,235 +85,399 @@ void RayTracer::Instance::raytrace() {
     });
 }
 
+void RayTracer::Instance::addStatistics(const Statistics &statistics) {
+    std::lock_guard<std::mutex> lock(m_statisticsMutex);
+    m_raytracer.m_statistics += statistics;
+}
+
 RayTracer::Instance::Thread::Thread(Instance &instance) :
-    m_i{ instance },
-    m_randGen{ std::random_device{}() }
+    m_i{ instance }
 {
+    // traversing the ray tree depth first leaves at most one pending sibling per bounce
+    m_rayStack.reserve(m_i.m_scene.camera().maxBounces() + 2);
+    m_lightCandidates.reserve(m_i.m_scene.lights().size());
+    m_lastOccluders.resize(m_i.m_scene.lights().size(), m_i.m_scene.objects().size());
 }
 
 void RayTracer::Instance::Thread::raytrace() {
-    u32 y;
-    while ((y = m_i.m_NextLine.fetch_add(1, std::memory_order_relaxed)) < m_i.m_picSize.y) {
-        raytraceLine(y);
+    // the threads fetch the picture tiles one after another
+    const UDim2 tiles = m_i.m_picture.tiles();
+    const u32 tileCount = m_i.m_tiles.empty() ? tiles.x * tiles.y : static_cast<u32>(m_i.m_tiles.size());
+    m_statistics.tiles = tiles;
+    m_statistics.tileSeconds.resize(tiles.x * tiles.y);
+    u32 next;
+    while ((next = m_i.m_nextTile.fetch_add(1, std::memory_order_relaxed)) < tileCount) {
+        raytraceTile(m_i.m_tiles.empty() ? next : m_i.m_tiles[next]);
     }
+    m_i.addStatistics(m_statistics);
 }
 
-void RayTracer::Instance::Thread::raytraceLine(u32 y) {
-    scalar rayY = m_i.m_halfFov.y + y * m_i.m_pixelSize.y + 0.5f * m_i.m_pixelSize.y;
-    const u32 initialRayCount{ m_i.m_scene.camera().superSamplingPerAxis() };
-
-    scalar rayX = m_i.m_halfFov.x + 0.5f * m_i.m_pixelSize.x;
-    for (u32 x = 0; x < m_i.m_picSize.x; x++) {        
-        Radiance radiance;
-
-        // Supersampling:
-        // Cast one ray for each subpixel
-        // TODO: Consider Adaptive supersampling, like described here:
-        //   https://en.wikipedia.org/wiki/Supersampling#Computational_cost_and_adaptive_supersampling
-        // TODO: Better supersampling patterns?
-        for (u32 subY = 0; subY < initialRayCount; subY++) {
-            for (u32 subX = 0; subX < initialRayCount; subX++) {
-                // all this assumes camera is at origin (0, 0, 0)
-                const Vector2 subDisplacement{ 
-                    2.0f * (subX + 1) / (initialRayCount + 1) - 1.0f,
-                    2.0f * (subY + 1) / (initialRayCount + 1) - 1.0f
-                };
-                // we distribute the ray targets on the area of our pixel on the image plane
-                const Vector2 targetDisplacement = subDisplacement * m_i.m_pixelSize;
-                const Point3 targetOnImagePlane = Point3{ rayX, rayY, -1.0f } + targetDisplacement;
-
-                // Depth of Focus:
-                // this scales the point from image plane at z = -1.0f as target
-                // to the focus plane on z = -focusDistance as target along the ray (which comes from the origin)
-                // -> so it is effectively just a scaling by the focusDistance
-                const Point3 targetOnFocusPlane = m_i.m_cameraTransformation * (targetOnImagePlane * m_i.m_scene.camera().focusDistance());
-                // we randomly distribute the ray origin on the lens area
-                // TODO: maybe think about better sampling patterns for the camera lens (together with supersampling)
-                const Vector2 originDisplacement{
-                    (subDisplacement + Vector2{ m_randDis(m_randGen), m_randDis(m_randGen) } * (1.0f / initialRayCount)) *
-                    m_i.m_scene.camera().lensSize()
-                };
-                 const Point3 rayOrigin = m_i.m_cameraTransformation * (Point3{ 0.0f, 0.0f, 0.0f }) + originDisplacement;
-
-                // the ray goes from origin to the target point on the focus plane
-                Ray ray(rayOrigin, targetOnFocusPlane - rayOrigin);
-
-                // Dispersion support:
-                // 8 rays (= 45 degree hue steps) look quite nice
-                // TODO: consider using a precalculated HSV RGB map
-                // TODO: make it configurable
-                // TODO: find out why it is only half of the brightness
-                if (m_i.m_scene.dispersionMode()) {
-                    for (float h = 0.0f; h < 360.0f; h += 45.0f) {
-                        radiance += castRay(ray, 0, h / 180.0f - 1.0f) * HSVtoRGB(h, 100.0f, 100.0f) / 4.0f;
-                    }
-                } else {
-                    radiance += castRay(ray, 0, 0);
-                }
+void RayTracer::Instance::Thread::raytraceTile(u32 tile) {
+    const UDim2 tiles = m_i.m_picture.tiles();
+    const u32 startX = tile % tiles.x * Picture::TILE_SIZE;
+    const u32 startY = tile / tiles.x * Picture::TILE_SIZE;
+    const u32 endX = std::min(startX + Picture::TILE_SIZE, m_i.m_picSize.x);
+    const u32 endY = std::min(startY + Picture::TILE_SIZE, m_i.m_picSize.y);
+    const auto beginTime{ std::chrono::steady_clock::now() };
+    for (u32 y = startY; y < endY; y++) {
+        for (u32 x = startX; x < endX; x++) {
+            if (m_i.m_staticPixels && !m_i.m_recordAnimatedBounds && m_i.m_staticPixels[y * m_i.m_picSize.x + x]) {
+                // the picture keeps the pixel of the recording subframe
+                m_statistics.reusedPixels++;
+                continue;
+            }
+            if (m_i.m_pixelCost) {
+                const auto pixelBeginTime{ std::chrono::steady_clock::now() };
+                const u64 pixelBeginTests = intersectionTests();
+                raytracePixel(x, y);
+                m_i.m_pixelCost[y * m_i.m_picSize.x + x] = m_i.m_raytracer.m_recordPixelCost == PixelCost::Time ?
+                    std::chrono::duration<float>(std::chrono::steady_clock::now() - pixelBeginTime).count() :
+                    static_cast<float>(intersectionTests() - pixelBeginTests);
+            } else {
+                raytracePixel(x, y);
             }
         }
-        Radiance origRadiance = m_i.m_picture.get({ x, y });
-        m_i.m_picture.set({ x, y }, origRadiance + radiance * (1.0f / (initialRayCount * initialRayCount)));
-        rayX += m_i.m_pixelSize.x;
+    }
+    m_statistics.tileSeconds[tile] += std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+    if (m_i.m_tileFinished) {
+        m_i.m_tileFinished(m_i.m_picture, tile);
     }
 }
 
-Radiance RayTracer::Instance::Thread::castRay(const Ray &ray, u32 recursion, scalar wavelength) const {
-    const Scene &scene = m_i.m_scene;
+// intersection tests of this thread so far, sphere tracing steps count as tests
+u64 RayTracer::Instance::Thread::intersectionTests() const {
+    return std::accumulate(m_statistics.intersectionTests.begin(), m_statistics.intersectionTests.end(), m_statistics.juliaMarchSteps);
+}
+
+void RayTracer::Instance::Thread::raytracePixel(u32 x, u32 y) {
+    const scalar rayY = m_i.m_halfFov.y + y * m_i.m_pixelSize.y + 0.5f * m_i.m_pixelSize.y;
+    const scalar rayX = m_i.m_halfFov.x + x * m_i.m_pixelSize.x + 0.5f * m_i.m_pixelSize.x;
+    const Camera &camera = m_i.m_scene.camera();
+    const u32 initialRayCount{ camera.samplesPerPixel() };
+    const PixelSampler sampler(camera.samplePattern(), initialRayCount, m_i.m_scene.seed(), { x, y }, m_i.m_scene.loadTime());
+    const u32 timeSamples{ m_i.m_timeSamples };
+    const u32 rayCount{ initialRayCount * timeSamples };
+    Radiance radiance;
+    m_touchedAnimated = false;
+
+    // Supersampling:
+    // Cast one ray for each sample of the pixel
+    // TODO: Consider Adaptive supersampling, like described here:
+    //   https://en.wikipedia.org/wiki/Supersampling#Computational_cost_and_adaptive_supersampling
+    for (u32 rayIndex = 0; rayIndex < rayCount; rayIndex++) {
+        const u32 sample = rayIndex / timeSamples;
+        // Time sampled motion blur:
+        // every pixel sample is cast at several times within the shutter time,
+        // the camera moves like the objects (rotation interpolated spherically, position linearly)
+        const scalar time = timeSamples > 1 ? sampler.get1D(rayIndex, rayCount, SampleDimension::Time) : 0.0f;
+        const Matrix34 cameraTransformation = timeSamples > 1 ? m_i.m_cameraMotion.at(time) : m_i.m_cameraTransformation;
+        const scalar focusDistance = lerp(camera.focusDistance(), m_i.m_closeFocusDistance, time);
+
+        // all this assumes camera is at origin (0, 0, 0)
+        // we distribute the ray targets on the sample area of our pixel on the image plane
+        const Vector2 targetDisplacement = (sampler.get2D(sample, SampleDimension::Pixel) - Vector2{ 0.5f, 0.5f }) * m_i.m_sampleArea;
+        const Point3 targetOnImagePlane = Point3{ rayX, rayY, -1.0f } + targetDisplacement;
+
+        // Depth of Focus:
+        // this scales the point from image plane at z = -1.0f as target
+        // to the focus plane on z = -focusDistance as target along the ray (which comes from the origin)
+        // -> so it is effectively just a scaling by the focusDistance
+        const Point3 targetOnFocusPlane = cameraTransformation * (targetOnImagePlane * focusDistance);
+        // we distribute the ray origins on the round lens area
+        const Vector2 originDisplacement{ squareToDisk(sampler.get2D(sample, SampleDimension::Lens)) * camera.lensSize() };
+        const Point3 rayOrigin = cameraTransformation * (Point3{ 0.0f, 0.0f, 0.0f }) + originDisplacement;
+
+        // the ray goes from origin to the target point on the focus plane
+        const Vector3 rayVector = targetOnFocusPlane - rayOrigin;
+        Ray ray(rayOrigin, rayVector);
+        ray.setTime(time);
+        m_lightSeed = sampler.seed(rayIndex, SampleDimension::Light);
+        m_lightRandomNumbers = 0;
+        // Ray differentials: change of the normalized direction when the target moves by one subpixel
+        const scalar rayVectorLength = rayVector.length();
+        auto differential = [&ray, rayVectorLength] (const Vector3 &targetStep) {
+            return RayDifferential{ { 0.0f, 0.0f, 0.0f },
+                (targetStep - ray.direction() * ray.direction().dot(targetStep)) * (1.0f / rayVectorLength) };
+        };
+        ray.setDifferentials({ differential(m_i.m_subPixelSteps[0]), differential(m_i.m_subPixelSteps[1]) });
 
-    if (recursion > scene.camera().maxBounces()) {
-        return Radiance{};
+        // Dispersion support:
+        // 8 rays (= 45 degree hue steps) look quite nice
+        // TODO: consider using a precalculated HSV RGB map
+        // TODO: make it configurable
+        // TODO: find out why it is only half of the brightness
+        if (m_i.m_scene.dispersionMode()) {
+            for (float h = 0.0f; h < 360.0f; h += 45.0f) {
+                radiance += castRay(ray, h / 180.0f - 1.0f) * HSVtoRGB(h, 100.0f, 100.0f) / 4.0f;
+            }
+        } else {
+            radiance += castRay(ray, 0);
+        }
+    }
+    m_i.m_picture.set({ x, y }, radiance * (1.0f / rayCount));
+    if (m_i.m_recordAnimatedBounds) {
+        m_i.m_staticPixels[y * m_i.m_picSize.x + x] = !m_touchedAnimated;
+    }
+}
+
+// Iterative integrator:
+//   Instead of recursing into reflection and refraction rays, they get pushed
+//   onto an explicit stack together with their throughput weight.
+//   The radiance found for every ray is weighted and summed up.
+Radiance RayTracer::Instance::Thread::castRay(const Ray &ray, scalar wavelength) {
+    Radiance rad;
+    scalar alpha = 0.0f;
+    bool primary = true;
+
+    m_statistics.primaryRays++;
+    m_rayStack.clear();
+    m_rayStack.push_back(RayTask{ ray, 1.0f, 0 });
+    while (!m_rayStack.empty()) {
+        const RayTask task = m_rayStack.back();
+        m_rayStack.pop_back();
+        const Radiance taskRad = traceRay(task, wavelength);
+        if (primary) {
+            // only the camera ray defines the alpha channel (background or object)
+            alpha = taskRad.a;
+            primary = false;
+        }
+        rad += taskRad * task.weight;
+    }
+    rad.a = alpha;
+    return rad;
+}
+
+// Puts a reflection or refraction ray onto the ray stack,
+// unless it exceeds the bounce limit or contributes too little
+bool RayTracer::Instance::Thread::spawnRay(const Ray &ray, scalar weight, u32 recursion) {
+    const Camera &camera = m_i.m_scene.camera();
+    if (recursion > camera.maxBounces()) {
+        return false;
+    }
+    if (weight < camera.minRayWeight()) {
+        m_statistics.culledRays++;
+        return false;
     }
+    m_rayStack.push_back(RayTask{ ray, weight, recursion });
+    return true;
+}
+
+// for recording the static pixels (see RayTracer::setAnimatedBounds())
+void RayTracer::Instance::Thread::checkAnimatedBounds(const Ray &ray, scalar max_distance) {
+    if (m_i.m_recordAnimatedBounds && !m_touchedAnimated) {
+        m_touchedAnimated = std::any_of(m_i.m_recordAnimatedBounds->begin(), m_i.m_recordAnimatedBounds->end(),
+            [&ray, max_distance] (const BoundingBox &bounds) { return bounds.intersects(ray, max_distance); });
+    }
+}
+
+Radiance RayTracer::Instance::Thread::traceRay(const RayTask &task, scalar wavelength) {
+    const Scene &scene = m_i.m_scene;
+    const Ray &ray = task.ray;
 
-    Radiance rad = scene.background();
     scalar max_distance = INFINITE;
+    const Object *nearestObject = nullptr;
+    std::optional<Intersection> nearestIntersection;
+    scalar nearest_cos_angle_ray_normal = 0.0f;
+    checkAnimatedBounds(ray, max_distance);
 
     // Go over all objects
     for (const auto &object : scene.objects()) {
         // Check if ray intersects the object (and intersection is the nearest found yet)
-        if (const auto intersection = object.intersect(ray, max_distance)) {
-            // Interesected -> calculate Radiance for pixel
-            const Material &material = object.material();
-            scalar cos_angle_ray_normal = std::clamp(ray.direction().dot(intersection->normal), -1.0f, 1.0f);
+        m_statistics.intersectionTests[static_cast<size_t>(object.primitiveType())]++;
+        if (const auto intersection = object.intersect(ray, max_distance, m_statistics.juliaMarchSteps)) {
+            const scalar cos_angle_ray_normal = std::clamp(ray.direction().dot(intersection->normal), -1.0f, 1.0f);
 
-            if (cos_angle_ray_normal >= 0.0f && (material.transmittance == 0.0f || norm(material.refraction) == 0.0f)) {
+            if (cos_angle_ray_normal >= 0.0f && !(object.material().shadingClass & Material::Transparent)) {
                 // we do not see back-faces of non transparent objects
                 continue;
             }
 
             // ray intersects front face of object or its material is transparent
-            // so we see it and it replaces background or any previously detected object (which must be more far way)
-            rad = Radiance{};
+            // so we see it and it replaces any previously detected object (which must be more far way)
             max_distance = intersection->distance;
+            nearestObject = &object;
+            nearestIntersection = intersection;
+            nearest_cos_angle_ray_normal = cos_angle_ray_normal;
+        }
+    }
 
-            if (cos_angle_ray_normal < 0.0f) {
-                // front-facing surface
-                rad += calcPhong(ray, *intersection, material);
-                rad += object.getPhoton(intersection->photonCoordinate);
-            }
+    if (nearestObject == nullptr) {
+        return scene.background();
+    }
+
+    // Interesected -> calculate Radiance for pixel only once for the nearest object
+    // using the shading function specialised for its material
+    const ShadeFunction shadeFunction = s_shadeFunctions[nearestObject->material().shadingClass];
+    return (this->*shadeFunction)(task, *nearestObject, *nearestIntersection, nearest_cos_angle_ray_normal, wavelength).withoutAlpha();
+}
+
+template <size_t... ShadingClasses>
+std::array<RayTracer::Instance::Thread::ShadeFunction, sizeof...(ShadingClasses)>
+RayTracer::Instance::Thread::makeShadeFunctions(std::index_sequence<ShadingClasses...>) {
+    return { &Thread::shade<ShadingClasses>... };
+}
+
+const std::array<RayTracer::Instance::Thread::ShadeFunction, Material::ShadingClassCount>
+RayTracer::Instance::Thread::s_shadeFunctions = makeShadeFunctions(std::make_index_sequence<Material::ShadingClassCount>{});
+
+// Each specialisation only contains the code paths needed by its shading class,
+// so the common opaque diffuse case ends up as straight-line code.
+template <u8 ShadingClass>
+Radiance RayTracer::Instance::Thread::shade(const RayTask &task, const Object &object, const Intersection &intersection, scalar cos_angle_ray_normal, scalar wavelength) {
+    constexpr bool textured = (ShadingClass & Material::Textured) != 0;
+    constexpr bool reflective = (ShadingClass & Material::Reflective) != 0;
+    constexpr bool transparent = (ShadingClass & Material::Transparent) != 0;
+    constexpr bool conductor = (ShadingClass & Material::Conductor) != 0;
+    const Material &material = object.material();
+    const Ray &ray = task.ray;
+    Radiance rad;
+
+    // back faces of non transparent objects got skipped already
+    if (!transparent || cos_angle_ray_normal < 0.0f) {
+        // front-facing surface
+        rad += calcPhong<textured>(ray, intersection, material);
+        rad += object.getPhoton(intersection.photonCoordinate);
+    }
 
-            // Let transmittance and reflectance values enable/disable refraction and reflection according
-            //   https://moodle.univie.ac.at/mod/forum/discuss.php?d=1811598
-            if ((material.transmittance != 0.0f || material.reflectance != 0.0f) && norm(material.refraction) > 0.0f) {
-                const scalar kr = calcFresnel(material, cos_angle_ray_normal, wavelength);
-                if (material.transmittance != 0.0f && kr < 1.0f) {
-                    rad += calcRefraction(ray, *intersection, material, cos_angle_ray_normal, recursion, wavelength) * (1.0f - kr);
+    if constexpr (reflective || transparent) {
+        const scalar kr = calcFresnel<conductor>(material, cos_angle_ray_normal, wavelength);
+        if constexpr (transparent) {
+            if (kr < 1.0f) {
+                if (const auto refractionRay = calcRefraction(ray, intersection, material, cos_angle_ray_normal, wavelength)) {
+                    if (spawnRay(*refractionRay, task.weight * (1.0f - kr), task.recursion + 1)) {
+                        m_statistics.refractionRays++;
+                    }
                 }
-                if (material.reflectance != 0.0f && kr > 0.0f) {
-                    rad += calcReflection(ray, *intersection, material, cos_angle_ray_normal, recursion, wavelength) * kr;
+            }
+        }
+        if constexpr (reflective) {
+            if (kr > 0.0f) {
+                if (spawnRay(calcReflection(ray, intersection, cos_angle_ray_normal), task.weight * kr, task.recursion + 1)) {
+                    m_statistics.reflectionRays++;
                 }
             }
-            rad = rad.withoutAlpha();
         }
     }
     return rad;
 }
 
-Color RayTracer::Instance::Thread::calcTexturePixelColorWithAntiAliasing(const Picture &texture, Point2 textureCoord) const {
-    UDim2 textureSize = texture.size();
-    scalar tmp; // unused tmp for modff()
-    // The texture is in repeat mode -> only use fractional part
-    textureCoord.x = modff(textureCoord.x, &tmp);
-    textureCoord.y = modff(textureCoord.y, &tmp);
-    Point2 texturePixel = { textureCoord.x * (textureSize.x - 1), textureCoord.y * (textureSize.y - 1) };
-
-    UPoint2 uTextureCoord1{
-        std::clamp(static_cast<u32>(texturePixel.x), 0u, textureSize.x - 1),
-        std::clamp(static_cast<u32>(texturePixel.y), 0u, textureSize.y - 1)
-    };
-    scalar textureFactor1 = (1 - modff(texturePixel.x, &tmp)) * (1 - modff(texturePixel.y, &tmp));
-    UPoint2 uTextureCoord2{
-        std::clamp(static_cast<u32>(std::ceil(texturePixel.x)), 0u, textureSize.x - 1),
-        std::clamp(static_cast<u32>(texturePixel.y), 0u, textureSize.y - 1)
-    };
-    scalar textureFactor2 = modff(texturePixel.x, &tmp) * (1 - modff(texturePixel.y, &tmp));
-    UPoint2 uTextureCoord3{
-        std::clamp(static_cast<u32>(texturePixel.x), 0u, textureSize.x - 1),
-        std::clamp(static_cast<u32>(std::ceil(texturePixel.y)), 0u, textureSize.y - 1)
-    };
-    scalar textureFactor3 = (1 - modff(texturePixel.x, &tmp)) * modff(texturePixel.y, &tmp);
-    UPoint2 uTextureCoord4{
-        std::clamp(static_cast<u32>(std::ceil(texturePixel.x)), 0u, textureSize.x - 1),
-        std::clamp(static_cast<u32>(std::ceil(texturePixel.y)), 0u, textureSize.y - 1)
-    };
-    scalar textureFactor4 = modff(texturePixel.x, &tmp) * modff(texturePixel.y, &tmp);
-
-    return texture.get(uTextureCoord1) * textureFactor1 +
-        texture.get(uTextureCoord2) * textureFactor2 +
-        texture.get(uTextureCoord3) * textureFactor3 +
-        texture.get(uTextureCoord4) * textureFactor4;
-}
-
-Radiance RayTracer::Instance::Thread::calcPhong(const Ray &ray, const Intersection &intersection, const Material &material) const {
+template <bool Textured>
+Radiance RayTracer::Instance::Thread::calcPhong(const Ray &ray, const Intersection &intersection, const Material &material) {
     const Scene &scene = m_i.m_scene;
     const Point3 point = intersection.point;
     const Vector3 normal = intersection.normal;
     Radiance rad;
 
     // get material color either from material or from texture
-    const Color materialColor = material.texture.empty() ?
-        material.color :
-        calcTexturePixelColorWithAntiAliasing(material.texture, intersection.textureCoordinate);
+    Color materialColor;
+    if constexpr (Textured) {
+        materialColor = material.texture.sample(intersection.textureCoordinate, calcTextureLod(ray, intersection, material.texture));
+    } else {
+        materialColor = material.color;
+    }
 
     rad += scene.ambientLight() * materialColor * material.phong.ka;
-    for (const Light &light : scene.lights()) {
+    // shadow rays keep the footprint of the hit point
+    std::array<RayDifferential, 2> hitDifferentials = ray.transferDifferentials(intersection.distance, normal);
+    for (RayDifferential &differential : hitDifferentials) {
+        differential.direction = { 0.0f, 0.0f, 0.0f };
+    }
+    // the contribution of every light if it is visible,
+    //   lights without contribution (or below the cutoff) need no shadow ray
+    m_lightCandidates.clear();
+    for (size_t lightIndex = 0; lightIndex < scene.lights().size(); lightIndex++) {
+        const Light &light = scene.lights()[lightIndex];
         Ray lightRay = light.type() == Light::Type::Parallel ?
             Ray(point, light.direction() * -1.0f) :
             Ray(point, light.position() - point);
         lightRay.addOffset(normal * EPSILON); // remove shadow acne
+        lightRay.setDifferentials(hitDifferentials);
+        lightRay.setTime(ray.time());
         const scalar lightDistance = light.type() == Light::Type::Parallel ?
             INFINITE :
             (light.position() - lightRay.origin()).length();
-        // check if light is visible
-        if (std::none_of(scene.objects().begin(), scene.objects().end(),
-            [lightRay, lightDistance] (const auto &objectForTest) {
-                const std::optional<Intersection> lightIntersect = objectForTest.intersect(lightRay, lightDistance);
-                return lightIntersect.has_value() && lightRay.direction().dot(lightIntersect->normal) < 0.0f; // only front faces cast shadows
-            })) {
-            // light is visible
-            // TODO: why don't we decrease power with distance for point lights?
-            //const Color lightPower = light.power() / (light.type() == Light::Type::Parallel ? 1 : 4.0f * PI * lightDistance * lightDistance);
-            const Color lightPower = light.power();
-            const Radiance diffuseRad = lightPower * materialColor * std::max(lightRay.direction().dot(normal), 0.0f) * material.phong.kd;
-            const Vector3 lightReflectionVector = (normal * lightRay.direction().dot(normal) * 2 - lightRay.direction()).normalized();
-            const Radiance specularRad = lightPower * pow(std::max(lightReflectionVector.dot(ray.direction() * -1), 0.0f), material.phong.exponent) * material.phong.ks;
-            rad += diffuseRad + specularRad;
+        // TODO: why don't we decrease power with distance for point lights?
+        //const Color lightPower = light.power() / (light.type() == Light::Type::Parallel ? 1 : 4.0f * PI * lightDistance * lightDistance);
+        const Color lightPower = light.power();
+        const Radiance diffuseRad = lightPower * materialColor * std::max(lightRay.direction().dot(normal), 0.0f) * material.phong.kd;
+        const Vector3 lightReflectionVector = (normal * lightRay.direction().dot(normal) * 2 - lightRay.direction()).normalized();
+        const Radiance specularRad = lightPower * pow(std::max(lightReflectionVector.dot(ray.direction() * -1), 0.0f), material.phong.exponent) * material.phong.ks;
+        const Radiance contribution = diffuseRad + specularRad;
+        const scalar luminance = contribution.luminance();
+        if (luminance > scene.lightCutoff()) {
+            m_lightCandidates.push_back(LightCandidate{ lightRay, lightDistance, contribution, luminance, lightIndex });
+        }
+    }
+
+    const u32 shadowRays = scene.shadowRays();
+    if (shadowRays == 0 || shadowRays >= m_lightCandidates.size()) {
+        // one shadow ray per light
+        for (const LightCandidate &candidate : m_lightCandidates) {
+            if (!occluded(candidate.ray, candidate.distance, candidate.light)) {
+                rad += candidate.contribution;
+            }
+        }
+        return rad;
+    }
+
+    // Light selection by importance sampling:
+    //   the shadow rays are distributed over the lights proportional to their luminance
+    //   (systematic sampling, so a light with more than total / shadowRays is always selected).
+    //   Every shadow ray reaching its light adds contribution / probability / shadowRays.
+    const scalar totalLuminance = std::accumulate(m_lightCandidates.begin(), m_lightCandidates.end(), 0.0f,
+        [] (scalar sum, const LightCandidate &candidate) { return sum + candidate.luminance; });
+    const scalar step = totalLuminance / shadowRays;
+    scalar target = toUnit(hashCombine(m_lightSeed, m_lightRandomNumbers++)) * step;
+    scalar cumulated = 0.0f;
+    u32 remaining = shadowRays;
+    for (size_t i = 0; i < m_lightCandidates.size() && remaining > 0; i++) {
+        const LightCandidate &candidate = m_lightCandidates[i];
+        cumulated += candidate.luminance;
+        u32 selected = 0;
+        // the last light takes the rest, which could be left by rounding errors of the sums
+        while (selected < remaining && (target < cumulated || i + 1 == m_lightCandidates.size())) {
+            selected++;
+            target += step;
+        }
+        remaining -= selected;
+        if (selected > 0 && !occluded(candidate.ray, candidate.distance, candidate.light)) {
+            rad += candidate.contribution * (selected * step / candidate.luminance);
         }
     }
     return rad;
 }
 
-// following functions from https ://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
-//   extended with distinction (complex numbers)
-//   and dispersion
-scalar RayTracer::Instance::Thread::calcFresnel(const Material &material, scalar cos_angle_ray_normal, scalar wavelength) const {
-    std::complex<scalar> etai = 1;
-    std::complex<scalar> etat = material.refraction + wavelength * material.dispersion;
-    if (cos_angle_ray_normal > 0.0f) {
-        // inside
-        std::swap(etai, etat);
+// traces a shadow ray to the light, true if an object is between the ray origin and max_distance
+bool RayTracer::Instance::Thread::occluded(const Ray &ray, scalar max_distance, size_t light) {
+    m_statistics.shadowRays++;
+    checkAnimatedBounds(ray, max_distance);
+    const std::vector<Object> &objects = m_i.m_scene.objects();
+    const auto occludes = [this, &ray, max_distance] (const Object &objectForTest) {
+        m_statistics.intersectionTests[static_cast<size_t>(objectForTest.primitiveType())]++;
+        const std::optional<Intersection> lightIntersect = objectForTest.intersect(ray, max_distance, m_statistics.juliaMarchSteps);
+        return lightIntersect.has_value() && ray.direction().dot(lightIntersect->normal) < 0.0f; // only front faces cast shadows
+    };
+    // any occluder gives the same result, so the last one of this light is a free guess
+    size_t &lastOccluder = m_lastOccluders[light];
+    if (lastOccluder < objects.size()) {
+        if (occludes(objects[lastOccluder])) {
+            m_statistics.cachedOccluders++;
+            return true;
+        }
     }
-    // get the sinus of the incidence angle via the Pythagorean identity
-    // and multiply it with the refraction indices quotient
-    // to get the sinus of the angle the refracted (transmitted) ray
-    const std::complex<scalar> sint = etai / etat * sqrtf(std::max(0.0f, 1 - cos_angle_ray_normal * cos_angle_ray_normal));
-    // check if we do not have total internal reflection
-    if (norm(sint) < 1.0f) {
-        // no total internal reflection -> calculate reflection coefficient
-        // get the cosinus of the refracted angle via the Pythagorean identity
-        //const std::complex<scalar> cost = sqrtf(std::max(0.0f, 1.0f - sint * sint));
-        const std::complex<scalar> cost = sqrt(1.0f - sint * sint);
-        const scalar cos_angle_ray_normalAbs = fabsf(cos_angle_ray_normal);
-        // TODO: check if Rs and Rp are swapped in this formulas? (not important for us, but out of curiousity..)
-        const std::complex<scalar> Rs = (etat * cos_angle_ray_normalAbs - etai * cost) / (etat * cos_angle_ray_normalAbs + etai * cost);
-        const std::complex<scalar> Rp = (etai * cos_angle_ray_normalAbs - etat * cost) / (etai * cos_angle_ray_normalAbs + etat * cost);
-        return (norm(Rs) + norm(Rp)) / 2;
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (i != lastOccluder && occludes(objects[i])) {
+            lastOccluder = i;
+            return true;
+        }
     }
-
-    return 1.0f; // total internal reflection  
+    // the last occluder is kept, the next shading point may be in its shadow again
+    return false;
 }
 
-Radiance RayTracer::Instance::Thread::calcRefraction(const Ray &ray, const Intersection &intersection, const Material &material, scalar cos_angle_ray_normal, u32 recursion, scalar wavelength) const {
+// following functions from https ://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
+//   extended with dispersion (see fresnel.h for the reflection coefficient)
+std::optional<Ray> RayTracer::Instance::Thread::calcRefraction(const Ray &ray, const Intersection &intersection, const Material &material, scalar cos_angle_ray_normal, scalar wavelength) const {
     const Point3 point = intersection.point;
     const Vector3 normal = intersection.normal;
     scalar cos_angle_ray_normalTurned{ cos_angle_ray_normal };
@@ -288,12 +498,22 @@ Radiance RayTracer::Instance::Thread::calcRefraction(const Ray &ray, const Inter
         const Vector3 refractionVector = ray.direction() * refractionIndex + normalTurned * (refractionIndex * cos_angle_ray_normalTurned - sqrtf(k));
         Ray refractionRay{ point, refractionVector };
         refractionRay.addOffset(normal * (outside ? -EPSILON : EPSILON));
-        return castRay(refractionRay, recursion + 1, wavelength);
+        // differentiate the refraction vector, the normal is assumed to be constant (planar surface)
+        std::array<RayDifferential, 2> differentials = ray.transferDifferentials(intersection.distance, normal);
+        const scalar sqrtK = std::max(sqrtf(k), EPSILON);
+        for (RayDifferential &differential : differentials) {
+            const scalar dCos = -differential.direction.dot(normalTurned);
+            differential.direction = differential.direction * refractionIndex +
+                normalTurned * (dCos * (refractionIndex - refractionIndex * refractionIndex * cos_angle_ray_normalTurned / sqrtK));
+        }
+        refractionRay.setDifferentials(differentials);
+        refractionRay.setTime(ray.time());
+        return refractionRay;
     }
-    return {};
+    return std::nullopt;
 }
 
-Radiance RayTracer::Instance::Thread::calcReflection(const Ray &ray, const Intersection &intersection, const Material &, scalar cos_angle_ray_normal, u32 recursion, scalar wavelength) const {
+Ray RayTracer::Instance::Thread::calcReflection(const Ray &ray, const Intersection &intersection, scalar cos_angle_ray_normal) const {
     const Point3 point = intersection.point;
     const Vector3 normal = intersection.normal;
     bool outside = false;
@@ -304,5 +524,21 @@ Radiance RayTracer::Instance::Thread::calcReflection(const Ray &ray, const Inter
     const Vector3 reflectionVector = ray.direction() - normal * cos_angle_ray_normal * 2;
     Ray mirrorRay{ point, reflectionVector };
     mirrorRay.addOffset(normal * (outside ? EPSILON : -EPSILON));
-    return castRay(mirrorRay, recursion + 1, wavelength);
+    // differentiate the reflection vector, the normal is assumed to be constant (planar surface)
+    std::array<RayDifferential, 2> differentials = ray.transferDifferentials(intersection.distance, normal);
+    for (RayDifferential &differential : differentials) {
+        differential.direction = differential.direction - normal * differential.direction.dot(normal) * 2;
+    }
+    mirrorRay.setDifferentials(differentials);
+    mirrorRay.setTime(ray.time());
+    return mirrorRay;
+}
+
+// Level of detail of the mip map: log2 of the number of texels covered by the ray footprint on the surface.
+scalar RayTracer::Instance::Thread::calcTextureLod(const Ray &ray, const Intersection &intersection, const Texture &texture) const {
+    const std::array<RayDifferential, 2> differentials = ray.transferDifferentials(intersection.distance, intersection.normal);
+    const scalar footprint = std::max(differentials[0].origin.length(), differentials[1].origin.length());
+    const UDim2 size = texture.size();
+    const scalar texelsPerDistance = std::max(intersection.textureScale.x * size.x, intersection.textureScale.y * size.y);
+    return log2f(footprint * texelsPerDistance);
 }
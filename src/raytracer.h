@@ -1,36 +1,130 @@
 #pragma once
+#include <algorithm>
+#include <array>
 #include <atomic>
-#include <random>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
 
 #include "scene.h"
 
 class RayTracer {
 public:
-    Picture raytrace(const Scene &scene) const;
+    // cost recorded for every pixel (Statistics::pixelCost) for a cost heatmap
+    enum class PixelCost {
+        None,
+        Time, // render time in seconds, only exact with not more threads than cpu cores
+        IntersectionTests // intersection tests and julia set sphere tracing steps, independent of the machine
+    };
+
+    // counters of the last raytrace() call, collected per thread
+    struct Statistics {
+        u64 primaryRays = 0; // camera rays, one per subpixel (and wavelength in dispersion mode)
+        u64 shadowRays = 0;
+        u64 cachedOccluders = 0; // shadow rays blocked by the last occluder of their light, without testing the other objects
+        u64 reflectionRays = 0;
+        u64 refractionRays = 0;
+        u64 culledRays = 0; // reflection and refraction rays skipped because of their low weight
+        u64 reusedPixels = 0; // static pixels kept from the first subframe (see setAnimatedBounds())
+        std::array<u64, Object::PrimitiveTypeCount> intersectionTests{}; // indexed by Object::PrimitiveType
+        u64 juliaMarchSteps = 0; // sphere tracing steps of the julia set intersection tests
+        UDim2 tiles{ 0, 0 }; // tile columns and rows of the picture
+        std::vector<double> tileSeconds; // render time of each tile (see Picture::tiles())
+        std::vector<float> pixelCost; // cost of each pixel line by line, only if recorded (see PixelCost)
+
+        Statistics &operator+=(const Statistics &rhs) {
+            primaryRays += rhs.primaryRays;
+            shadowRays += rhs.shadowRays;
+            cachedOccluders += rhs.cachedOccluders;
+            reflectionRays += rhs.reflectionRays;
+            refractionRays += rhs.refractionRays;
+            culledRays += rhs.culledRays;
+            reusedPixels += rhs.reusedPixels;
+            for (size_t i = 0; i < intersectionTests.size(); i++) {
+                intersectionTests[i] += rhs.intersectionTests[i];
+            }
+            juliaMarchSteps += rhs.juliaMarchSteps;
+            // the tile times of several subframes or frames get summed up
+            tiles = rhs.tiles;
+            tileSeconds.resize(std::max(tileSeconds.size(), rhs.tileSeconds.size()));
+            for (size_t i = 0; i < rhs.tileSeconds.size(); i++) {
+                tileSeconds[i] += rhs.tileSeconds[i];
+            }
+            pixelCost.resize(std::max(pixelCost.size(), rhs.pixelCost.size()));
+            for (size_t i = 0; i < rhs.pixelCost.size(); i++) {
+                pixelCost[i] += rhs.pixelCost[i];
+            }
+            return *this;
+        }
+    };
+
+    // called by the render threads after each finished tile, must be thread safe
+    using TileCallback = std::function<void(const Picture &picture, u32 tile)>;
+
+    // renders the listed picture tiles (see Picture::tiles()), all tiles if the list is empty
+    Picture raytrace(const Scene &scene, const std::vector<u32> &tiles = {});
+    // renders into an existing picture, the other tiles keep their content
+    void raytrace(const Scene &scene, Picture &picture, const std::vector<u32> &tiles, const TileCallback &tileFinished = {});
+    const Statistics &statistics() const { return m_statistics; }
+    void setRecordPixelCost(PixelCost pixelCost) { m_recordPixelCost = pixelCost; }
+    // Reuse of static pixels between the subframes of motion blur:
+    //   With bounds the next raytrace() records the static pixels, none of their rays (including shadow rays) crosses
+    //   the bounds of the animated objects. The following raytrace() calls skip them and keep their content in the picture.
+    //   Nothing renders all pixels again.
+    void setAnimatedBounds(std::optional<std::vector<BoundingBox>> animatedBounds) {
+        m_animatedBounds = std::move(animatedBounds);
+        m_staticPixels.clear();
+    }
 
 private:
     class Instance;
+
+    Statistics m_statistics;
+    PixelCost m_recordPixelCost = PixelCost::None;
+    std::optional<std::vector<BoundingBox>> m_animatedBounds;
+    std::vector<u8> m_staticPixels; // 1 for static pixels line by line, empty until recorded
 };
 
 class RayTracer::Instance {
 public:
-    Instance(const RayTracer &raytracer, const Scene &scene, Picture &picture);
+    Instance(RayTracer &raytracer, const Scene &scene, Picture &picture, const std::vector<u32> &tiles, const TileCallback &tileFinished,
+        bool recordStaticPixels);
     void raytrace();
 
 private:
     class Thread;
 
-    const RayTracer &m_raytracer;
+    void addStatistics(const Statistics &statistics);
+
+    RayTracer &m_raytracer;
     const Scene &m_scene;
     Picture &m_picture;
+    const std::vector<u32> &m_tiles;
+    const TileCallback &m_tileFinished;
     const UDim2 m_picSize;
     const Dim2 m_picSizeF;
     const scalar m_halfFovX;
     const Point2 m_halfFov;
     const Dim2 m_pixelSize;
     const Dim2 m_subPixelSize;
+    const Dim2 m_sampleArea; // image plane area the pixel samples are spread on
     const Matrix34 m_cameraTransformation;
-    std::atomic<u32> m_NextLine;
+    // the camera from the beginning to the end of the shutter time, standing still if it does not move (see Scene::setMotion())
+    const TransformationMotion m_cameraMotion;
+    const scalar m_closeFocusDistance;
+    // rays per pixel sample with different times, more than 1 only for time sampled motion blur
+    const u32 m_timeSamples;
+    const std::array<Vector3, 2> m_subPixelSteps; // subpixel distance on the focus plane in world coordinates
+    std::atomic<u32> m_nextTile;
+    std::mutex m_statisticsMutex;
+    // written directly by the threads (every pixel by one thread), nullptr if not recorded
+    float *const m_pixelCost;
+    // static pixel reuse (see RayTracer::setAnimatedBounds()): the bounds while recording, else nullptr
+    const std::vector<BoundingBox> *const m_recordAnimatedBounds;
+    // written like m_pixelCost while recording, else read to skip the static pixels, nullptr if not used
+    u8 *const m_staticPixels;
 };
 
 class RayTracer::Instance::Thread {
@@ -39,15 +133,52 @@ public:
     void raytrace();
 
 private:
-    void raytraceLine(u32 y);
-    Radiance castRay(const Ray &ray, u32 recursion, scalar wavelength) const;
-    Color calcTexturePixelColorWithAntiAliasing(const Picture &texture, Point2 textureCoord) const;
-    Radiance calcPhong(const Ray &ray, const Intersection &intersection, const Material &material) const;
-    scalar calcFresnel(const Material &material, scalar cos_angle_ray_normal, scalar wavelength) const;
-    Radiance calcRefraction(const Ray &ray, const Intersection &intersection, const Material &material, scalar cos_angle_ray_normal, u32 recursion, scalar wavelength) const;
-    Radiance calcReflection(const Ray &ray, const Intersection &intersection, const Material &material, scalar cos_angle_ray_normal, u32 recursion, scalar wavelength) const;
+    // an entry of the explicit ray stack used instead of recursion
+    struct RayTask {
+        Ray ray;
+        scalar weight; // throughput: factor of the radiance contributing to the camera ray
+        u32 recursion;
+    };
+    // a light of the current shading point with its shadow ray
+    struct LightCandidate {
+        Ray ray;
+        scalar distance;
+        Radiance contribution; // if the light is visible
+        scalar luminance; // of the contribution
+        size_t light; // index in Scene::lights()
+    };
+
+    void raytraceTile(u32 tile);
+    void raytracePixel(u32 x, u32 y);
+    u64 intersectionTests() const;
+    Radiance castRay(const Ray &ray, scalar wavelength);
+    Radiance traceRay(const RayTask &task, scalar wavelength);
+    bool spawnRay(const Ray &ray, scalar weight, u32 recursion);
+    bool occluded(const Ray &ray, scalar max_distance, size_t light);
+    void checkAnimatedBounds(const Ray &ray, scalar max_distance);
+    // shading function specialised for each Material::ShadingClass
+    template <u8 ShadingClass>
+    Radiance shade(const RayTask &task, const Object &object, const Intersection &intersection, scalar cos_angle_ray_normal, scalar wavelength);
+    template <bool Textured>
+    Radiance calcPhong(const Ray &ray, const Intersection &intersection, const Material &material);
+    std::optional<Ray> calcRefraction(const Ray &ray, const Intersection &intersection, const Material &material, scalar cos_angle_ray_normal, scalar wavelength) const;
+    Ray calcReflection(const Ray &ray, const Intersection &intersection, scalar cos_angle_ray_normal) const;
+    scalar calcTextureLod(const Ray &ray, const Intersection &intersection, const Texture &texture) const;
     
+    using ShadeFunction = Radiance (Thread::*)(const RayTask &, const Object &, const Intersection &, scalar, scalar);
+    template <size_t... ShadingClasses>
+    static std::array<ShadeFunction, sizeof...(ShadingClasses)> makeShadeFunctions(std::index_sequence<ShadingClasses...>);
+    static const std::array<ShadeFunction, Material::ShadingClassCount> s_shadeFunctions;
+
     Instance &m_i;
-    std::minstd_rand m_randGen;
-    std::uniform_real_distribution<float> m_randDis{ -1.0f, 1.0f };
+    std::vector<RayTask> m_rayStack;
+    Statistics m_statistics;
+    bool m_touchedAnimated = false; // a ray of the current pixel crossed the bounds of an animated object
+    std::vector<LightCandidate> m_lightCandidates;
+    // per light the index of the object which blocked its last shadow ray (the object count if none),
+    //   neighbouring shading points mostly have the same occluder, so it gets tested first
+    std::vector<size_t> m_lastOccluders;
+    // random numbers for the light selection of the current camera ray (see PixelSampler::seed())
+    u32 m_lightSeed = 0;
+    u32 m_lightRandomNumbers = 0;
 };
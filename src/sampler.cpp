@@ -0,0 +1,167 @@
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "sampler.h"
+
+// Permutation of i in [0, l) selected by p,
+//   from A. Kensler: Correlated Multi-Jittered Sampling (2013), https://graphics.pixar.com/library/MultiJitteredSampling/
+static u32 permute(u32 i, u32 l, u32 p) {
+    u32 w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p; i *= 0xe170893dU; i ^= p >> 16;
+        i ^= (i & w) >> 4; i ^= p >> 8; i *= 0x0929eb3fU;
+        i ^= p >> 23; i ^= (i & w) >> 1; i *= 1 | p >> 27;
+        i *= 0x6935fa69U; i ^= (i & w) >> 11; i *= 0x74dcb303U;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3U; i ^= (i & w) >> 2;
+        i *= 0xc860a3dfU; i &= w; i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// random number in [0, 1) for i selected by p, from the same paper
+static scalar randomFloat(u32 i, u32 p) {
+    i ^= p; i ^= i >> 17; i ^= i >> 10; i *= 0xb36534e5U;
+    i ^= i >> 12; i ^= i >> 21; i *= 0x93fc4795U; i ^= 0xdf6e307fU;
+    i ^= i >> 17; i *= 1 | p >> 18;
+    return i * (1.0f / 4294967808.0f);
+}
+
+static u32 reverseBits(u32 v) {
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ffU) << 8) | ((v & 0xff00ff00U) >> 8);
+    v = ((v & 0x0f0f0f0fU) << 4) | ((v & 0xf0f0f0f0U) >> 4);
+    v = ((v & 0x33333333U) << 2) | ((v & 0xccccccccU) >> 2);
+    v = ((v & 0x55555555U) << 1) | ((v & 0xaaaaaaaaU) >> 1);
+    return v;
+}
+
+// Owen scrambling: randomly permutes the elementary intervals of all sizes,
+//   hash based version by B. Burley: Practical Hash-based Owen Scrambling (2020), https://jcgt.org/published/0009/04/01/
+static u32 owenScramble(u32 v, u32 seed) {
+    v = reverseBits(v);
+    v ^= v * 0x3d20adeaU;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56U;
+    v ^= v * 0x53a22864U;
+    return reverseBits(v);
+}
+
+// Direction numbers of the first 4 dimensions of the Sobol sequence,
+//   from S. Joe and F. Y. Kuo: Constructing Sobol sequences with better two-dimensional projections (2008)
+static std::array<std::array<u32, 32>, 4> makeSobolDirections() {
+    struct Polynomial {
+        u32 degree;
+        u32 coefficients;
+        std::array<u32, 3> initialNumbers;
+    };
+    static const std::array<Polynomial, 3> polynomials{ {
+        { 1, 0, { 1, 0, 0 } },
+        { 2, 1, { 1, 3, 0 } },
+        { 3, 1, { 1, 3, 1 } }
+    } };
+    std::array<std::array<u32, 32>, 4> directions;
+    // the first dimension is the van der Corput sequence
+    for (u32 bit = 0; bit < 32; bit++) {
+        directions[0][bit] = 1U << (31 - bit);
+    }
+    for (u32 dim = 1; dim < 4; dim++) {
+        const Polynomial &polynomial = polynomials[dim - 1];
+        std::array<u32, 32> &v = directions[dim];
+        for (u32 bit = 0; bit < polynomial.degree; bit++) {
+            v[bit] = polynomial.initialNumbers[bit] << (31 - bit);
+        }
+        for (u32 bit = polynomial.degree; bit < 32; bit++) {
+            v[bit] = v[bit - polynomial.degree] ^ (v[bit - polynomial.degree] >> polynomial.degree);
+            for (u32 k = 1; k < polynomial.degree; k++) {
+                v[bit] ^= ((polynomial.coefficients >> (polynomial.degree - 1 - k)) & 1) * v[bit - k];
+            }
+        }
+    }
+    return directions;
+}
+
+static const std::array<std::array<u32, 32>, 4> SobolDirections = makeSobolDirections();
+
+static u32 sobol(u32 index, u32 dim) {
+    u32 result = 0;
+    for (u32 bit = 0; index != 0; index >>= 1, bit++) {
+        if (index & 1) {
+            result ^= SobolDirections[dim][bit];
+        }
+    }
+    return result;
+}
+
+PixelSampler::PixelSampler(SamplePattern pattern, u32 samples, u32 seed, UPoint2 pixel, scalar time) :
+    m_pattern{ pattern },
+    m_samples{ samples },
+    m_perAxis{ static_cast<u32>(std::lround(std::sqrt(samples))) }
+{
+    u32 timeBits;
+    std::memcpy(&timeBits, &time, sizeof(timeBits));
+    m_pixelSeed = hashCombine(hashCombine(hashCombine(seed, pixel.x), pixel.y), timeBits);
+}
+
+Vector2 PixelSampler::get2D(u32 index, SampleDimension dimension) const {
+    const u32 seed = hashCombine(m_pixelSeed, static_cast<u32>(dimension));
+    switch (m_pattern) {
+    case SamplePattern::Grid:
+        return dimension == SampleDimension::Pixel ? grid(index) : sobol(index, dimension);
+    case SamplePattern::Stratified:
+        return stratified(index, seed);
+    case SamplePattern::CorrelatedMultiJittered:
+        return correlatedMultiJittered(index, seed);
+    case SamplePattern::Sobol:
+    default:
+        return sobol(index, dimension);
+    }
+}
+
+// one random point in each of count intervals, the intervals get shuffled, so they are not correlated with the other dimensions
+scalar PixelSampler::get1D(u32 index, u32 count, SampleDimension dimension) const {
+    const u32 seed = hashCombine(m_pixelSeed, static_cast<u32>(dimension));
+    const u32 stratum = permute(index, count, seed);
+    return (stratum + randomFloat(stratum, seed * 0x967a889bU)) / count;
+}
+
+Vector2 PixelSampler::grid(u32 index) const {
+    return Vector2{ index % m_perAxis + 0.5f, index / m_perAxis + 0.5f } * (1.0f / m_perAxis);
+}
+
+Vector2 PixelSampler::stratified(u32 index, u32 seed) const {
+    // the cells get shuffled, so the cells of the dimensions are not correlated
+    const u32 cell = permute(index, m_samples, seed);
+    return Vector2{ cell % m_perAxis + randomFloat(cell, seed * 0x967a889bU), cell / m_perAxis + randomFloat(cell, seed * 0x368cc8b7U) } *
+        (1.0f / m_perAxis);
+}
+
+// Kensler's cmj() for any number of samples with a square aspect ratio
+Vector2 PixelSampler::correlatedMultiJittered(u32 index, u32 seed) const {
+    const u32 m = static_cast<u32>(std::sqrt(m_samples));
+    const u32 n = (m_samples + m - 1) / m;
+    const u32 s = permute(index, m_samples, seed * 0x51633e2dU);
+    const u32 sx = permute(s % m, m, seed * 0x68bc21ebU);
+    const u32 sy = permute(s / m, n, seed * 0x02e5be93U);
+    const scalar jx = randomFloat(s, seed * 0x967a889bU);
+    const scalar jy = randomFloat(s, seed * 0x368cc8b7U);
+    return { (sx + (sy + jx) / n) / m, (s + jy) / m_samples };
+}
+
+// The pixel and the lens use the dimensions 0, 1 and 2, 3 of the same points,
+//   so the samples are well distributed in all 4 dimensions.
+//   The index gets shuffled by Owen scrambling too, so the first points differ between the pixels.
+Vector2 PixelSampler::sobol(u32 index, SampleDimension dimension) const {
+    const u32 i = owenScramble(index, m_pixelSeed);
+    const u32 dim = 2 * static_cast<u32>(dimension);
+    return {
+        toUnit(owenScramble(::sobol(i, dim), hashCombine(m_pixelSeed, dim))),
+        toUnit(owenScramble(::sobol(i, dim + 1), hashCombine(m_pixelSeed, dim + 1)))
+    };
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "types.h"
+
+// Deterministic sampling: the random numbers of a pixel only depend on the scene seed,
+// the pixel position and the scene time, not on the thread rendering the pixel.
+// So renderings are reproducible and independent of the thread count.
+
+// integer hash "lowbias32" by Chris Wellons, https://nullprogram.com/blog/2018/07/31/
+inline u32 hashU32(u32 x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline u32 hashCombine(u32 seed, u32 value) {
+    return hashU32(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+// maps the unit square to the unit disk (centered at 0, 0) keeping the stratification,
+// concentric mapping by Shirley and Chiu
+inline Vector2 squareToDisk(Vector2 p) {
+    const Vector2 offset = p * 2.0f - Vector2{ 1.0f, 1.0f };
+    if (offset.x == 0.0f && offset.y == 0.0f) {
+        return offset;
+    }
+    if (fabsf(offset.x) > fabsf(offset.y)) {
+        const scalar theta = PI / 4 * (offset.y / offset.x);
+        return Vector2{ cosf(theta), sinf(theta) } * offset.x;
+    }
+    const scalar theta = PI / 2 - PI / 4 * (offset.x / offset.y);
+    return Vector2{ cosf(theta), sinf(theta) } * offset.y;
+}
+
+enum class SamplePattern : u8 {
+    Grid, // regular grid, the lens uses the Sobol pattern
+    Stratified, // one random point in every cell of a grid (jittered)
+    CorrelatedMultiJittered, // stratified in 2D and in both 1D projections
+    Sobol // Owen scrambled Sobol sequence
+};
+
+// every dimension gets an independent pattern
+enum class SampleDimension : u32 {
+    Pixel, // position within the pixel
+    Lens, // position on the lens (depth of field)
+    Time, // time of the ray within the shutter time (motion blur), 1D only
+    Light // selection of the lights for shadow rays, only random numbers (see PixelSampler::seed())
+};
+
+// the upper 24 bits fit exactly into a float
+inline scalar toUnit(u32 v) {
+    return (v >> 8) * (1.0f / (1U << 24));
+}
+
+// The sample points of a pixel for the selected pattern.
+class PixelSampler {
+public:
+    // Grid and Stratified need a square number of samples
+    PixelSampler(SamplePattern pattern, u32 samples, u32 seed, UPoint2 pixel, scalar time);
+
+    // point index (< samples) of the dimension in [0, 1)^2
+    Vector2 get2D(u32 index, SampleDimension dimension) const;
+    // point index (< count) of the dimension in [0, 1), stratified for all patterns
+    scalar get1D(u32 index, u32 count, SampleDimension dimension) const;
+    // seed for random numbers of the sample index, e.g. toUnit(hashCombine(seed, n)) for the n-th number
+    u32 seed(u32 index, SampleDimension dimension) const {
+        return hashCombine(hashCombine(m_pixelSeed, static_cast<u32>(dimension)), index);
+    }
+
+private:
+    Vector2 grid(u32 index) const;
+    Vector2 stratified(u32 index, u32 seed) const;
+    Vector2 correlatedMultiJittered(u32 index, u32 seed) const;
+    Vector2 sobol(u32 index, SampleDimension dimension) const;
+
+    const SamplePattern m_pattern;
+    const u32 m_samples;
+    const u32 m_perAxis; // grid cells per axis
+    u32 m_pixelSeed;
+};
@@ -12,5 +12,41 @@ Scene Scene::load(const std::string &filename, scalar time) {
     }
     Scene scene = SceneParser(file, filename, time).parse();
     scene.m_sceneFileName = filename;
+    scene.m_loadTime = time;
     return scene;
 }
+
+std::vector<BoundingBox> Scene::animatedBounds() const {
+    std::vector<BoundingBox> bounds;
+    for (const ObjectRange &range : m_animatedObjects) {
+        BoundingBox &box = bounds.emplace_back();
+        for (size_t i = range.first; i < range.second; i++) {
+            box.extend(m_objects[i].bounds());
+        }
+    }
+    return bounds;
+}
+
+bool Scene::staticPixelsReusable() const {
+    const bool timeIndependentSamples = m_camera.samplePattern() == SamplePattern::Grid && m_camera.lensSize() == 0.0f &&
+        (m_shadowRays == 0 || m_shadowRays >= m_lights.size());
+    return !m_animatedEnvironment && m_photonMapScanSteps <= 0.0f && timeIndependentSamples;
+}
+
+void Scene::setMotion(const Scene &close) {
+    if (close.m_objects.size() != m_objects.size()) {
+        throw std::runtime_error("the number of objects changes within the motion blur time");
+    }
+    m_moving = false;
+    for (size_t i = 0; i < m_objects.size(); i++) {
+        m_objects[i].setMotion(close.m_objects[i]);
+        m_moving = m_moving || m_objects[i].moving();
+    }
+    const Camera &closeCamera = close.m_camera;
+    if (closeCamera.cameraTransformation() != m_camera.cameraTransformation() || closeCamera.focusDistance() != m_camera.focusDistance()) {
+        m_closeCamera = closeCamera;
+        m_moving = true;
+    } else {
+        m_closeCamera.reset();
+    }
+}
@@ -2,34 +2,68 @@
 
 #include <istream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "objects.h"
 
 class Scene {
 public:
+    // the objects [first, second) created by one surface tag
+    using ObjectRange = std::pair<size_t, size_t>;
+
     static Scene load(const std::string &filename, scalar time = 0.0f);
 
     const std::string &sceneFileName() const { return m_sceneFileName; }
     const std::string &outFileName() const { return m_outFileName; }
     u32 threads() const { return m_threads; }
+    u32 seed() const { return m_seed; }
+    u32 pngCompression() const { return m_pngCompression; }
     scalar time() const { return m_time; }
+    // the animation time (0 to 1) the scene was loaded for, it seeds the random samples of the pixels
+    scalar loadTime() const { return m_loadTime; }
     u32 frames() const { return m_frames; }
     scalar fps() const { return m_fps; }
     u32 subFrames() const { return m_subFrames; }
+    // motion blur by rays with their own time instead of rendering all subframes
+    bool timeSampledMotionBlur() const { return m_timeSampledMotionBlur; }
     const Camera &camera() const { return m_camera; }
+    // the camera at the end of the motion (see setMotion())
+    const Camera &closeCamera() const { return m_closeCamera ? *m_closeCamera : m_camera; }
+    // some objects or the camera move within the ray times
+    bool moving() const { return m_moving; }
     Radiance background() const { return m_background; }
     Power ambientLight() const { return m_ambientLight; }
     const std::vector<Light> &lights() const { return m_lights; }
+    // shadow rays per shading point for a random selection of the lights, 0 for one shadow ray per light
+    u32 shadowRays() const { return m_shadowRays; }
+    // lights contributing less luminance to a shading point (without shadow) get ignored there
+    scalar lightCutoff() const { return m_lightCutoff; }
     std::vector<Object> &objects() { return m_objects; }
     const std::vector<Object> &objects() const { return m_objects; }
+    // the objects of surface tags with animated attributes
+    const std::vector<ObjectRange> &animatedObjects() const { return m_animatedObjects; }
+    // bounds of each entry of animatedObjects()
+    std::vector<BoundingBox> animatedBounds() const;
+    // Pixels showing only static objects are the same at every time of this scene (see RayTracer::setAnimatedBounds()):
+    //   a static camera, lights and background, no caustics and samples which do not depend on the time
+    //   (the pixel samples, the lens samples and the light selection are seeded with the time).
+    bool staticPixelsReusable() const;
+    // the camera, the lights or the background color have animated attributes
+    bool animatedEnvironment() const { return m_animatedEnvironment; }
     bool dispersionMode() const { return m_dispersionMode; }
     scalar photonMapScanSteps() const { return m_photonMapScanSteps; }
     u32 photonMapTextureSize() const { return m_photonMapTextureSize; }
     scalar photonMapFactor() const { return m_photonMapFactor; }
 
     void setOutFileName(const std::string &name) { m_outFileName = name; }
+    void setThreads(u32 threads) { m_threads = threads; }
+    // Time sampled motion blur: the objects and the camera move linearly to their state in close
+    //   (the scene loaded at the end of the shutter time) from ray time 0 to 1.
+    //   All other values (lights, materials) stay as in this scene.
+    void setMotion(const Scene &close);
 
     class SceneParser;
 
@@ -37,15 +71,25 @@ private:
     std::string m_sceneFileName;
     std::string m_outFileName;
     u32 m_threads{ 8 };
+    u32 m_seed{ 0 }; // of the random numbers (depth of field lens samples)
+    u32 m_pngCompression{ 6 }; // zlib compression level of the output file
     scalar m_time{ INFINITE };
+    scalar m_loadTime{ 0.0f };
     u32 m_frames{ 1 }; // frame count - for the animation extension
     scalar m_fps{ 25.0f }; // frames per second - for the animation extension
     u32 m_subFrames{ 1 }; // subframes - for the motion blur extension
+    bool m_timeSampledMotionBlur = false;
     Camera m_camera;
+    std::optional<Camera> m_closeCamera;
+    bool m_moving = false;
     Radiance m_background{ 0.0f, 0.0f, 0.0f, 0.0f };
     Power m_ambientLight;
     std::vector<Light> m_lights;
+    u32 m_shadowRays = 0;
+    scalar m_lightCutoff = 0.0f;
     std::vector<Object> m_objects;
+    std::vector<ObjectRange> m_animatedObjects;
+    bool m_animatedEnvironment = false;
     bool m_dispersionMode = false;
     scalar m_photonMapScanSteps = 0.0f;
     u32 m_photonMapTextureSize = 0;
@@ -33,10 +33,17 @@ Scene Scene::SceneParser::tag_scene() {
 
     scene.m_outFileName = attrToString("output_file");
     scene.m_threads = attrToU32("threads", scene.m_threads);    
+    scene.m_seed = attrToU32("seed", scene.m_seed);
+    scene.m_pngCompression = attrToU32("png_compression", scene.m_pngCompression);
+    if (scene.m_pngCompression > 9) {
+        throw std::runtime_error("png_compression must be between 0 and 9");
+    }
 
     while (!m_xml.nextTag().is("scene", Xml::TagType::End)) {        
+        m_animated = false;
         if (tagIs("background_color", Xml::TagType::Empty)) {
             scene.m_background = tag_color();
+            scene.m_animatedEnvironment = scene.m_animatedEnvironment || m_animated;
         } else if (tagIs("animation", Xml::TagType::Empty)) {
             scene.m_fps = attrToScalar("fps");
             scene.m_frames = static_cast<u32>(ceil(attrToScalar("length") * scene.m_fps));
@@ -44,18 +51,29 @@ Scene Scene::SceneParser::tag_scene() {
             scene.m_time = attrToScalar("time");
         } else if (tagIs("motionblur", Xml::TagType::Empty)) {
             scene.m_subFrames = static_cast<u32>(ceil(attrToScalar("subframes")));
+            const std::string mode = attrToString("mode", "subframes");
+            if (mode != "subframes" && mode != "rays") {
+                throw std::runtime_error("unknown motionblur mode " + mode);
+            }
+            scene.m_timeSampledMotionBlur = mode == "rays";
         } else if (tagIs("caustic", Xml::TagType::Empty)) {
             scene.m_photonMapScanSteps = attrToScalar("steps");
             scene.m_photonMapTextureSize = attrToU32("texture_size");
             scene.m_photonMapFactor = attrToScalar("factor");
         } else if (tagIs("camera", Xml::TagType::Start)) {
             scene.m_camera = tag_camera();
+            scene.m_animatedEnvironment = scene.m_animatedEnvironment || m_animated;
         } else if (tagIs("lights", Xml::TagType::Start)) {
             Lights lights = tag_lights();
             scene.m_ambientLight = lights.ambientLight;
             scene.m_lights = std::move(lights.lights);
+            scene.m_shadowRays = lights.shadowRays;
+            scene.m_lightCutoff = lights.cutoff;
+            scene.m_animatedEnvironment = scene.m_animatedEnvironment || m_animated;
         } else if (tagIs("surfaces", Xml::TagType::Start)) {
-            scene.m_objects = tag_surfaces();
+            Surfaces surfaces = tag_surfaces();
+            scene.m_objects = std::move(surfaces.objects);
+            scene.m_animatedObjects = std::move(surfaces.animatedObjects);
         } else {
             throw std::runtime_error("unknown tag in scene");
         }
@@ -83,8 +101,32 @@ Camera Scene::SceneParser::tag_camera() {
             camera.setResolution(UDim2{ attrToU32("horizontal"), attrToU32("vertical") });
         } else if (tagIs("max_bounces", Xml::TagType::Empty)) {
             camera.setMaxBounces(static_cast<u32>(std::lroundf(attrToScalar("n")))); // use scalar to allow animations
+            camera.setMinRayWeight(attrToScalar("min_weight", camera.minRayWeight()));
         } else if (tagIs("supersampling", Xml::TagType::Empty)) {
-            camera.setSuperSamplingPerAxis(attrToU32("subpixels_peraxis"));
+            // subpixels_peraxis n is a shortcut for n * n samples
+            const u32 subPixelsPerAxis = attrToU32("subpixels_peraxis", 0);
+            const u32 samples = attrToU32("samples", subPixelsPerAxis * subPixelsPerAxis);
+            const std::string patternName = attrToString("pattern", "grid");
+            SamplePattern pattern;
+            if (patternName == "grid") {
+                pattern = SamplePattern::Grid;
+            } else if (patternName == "stratified") {
+                pattern = SamplePattern::Stratified;
+            } else if (patternName == "cmj") {
+                pattern = SamplePattern::CorrelatedMultiJittered;
+            } else if (patternName == "sobol") {
+                pattern = SamplePattern::Sobol;
+            } else {
+                throw std::runtime_error("unknown supersampling pattern " + patternName);
+            }
+            if (samples == 0) {
+                throw std::runtime_error("supersampling needs subpixels_peraxis or samples");
+            }
+            const u32 perAxis = static_cast<u32>(std::lround(std::sqrt(samples)));
+            if ((pattern == SamplePattern::Grid || pattern == SamplePattern::Stratified) && perAxis * perAxis != samples) {
+                throw std::runtime_error("the supersampling patterns grid and stratified need a square number of samples");
+            }
+            camera.setSampling(pattern, samples);
         } else if (tagIs("dof", Xml::TagType::Empty)) {
             camera.setFocusPoint(tag_vector3());
             camera.setLensSize(attrToScalar("lenssize"));
@@ -97,6 +139,11 @@ Camera Scene::SceneParser::tag_camera() {
 
 Scene::SceneParser::Lights Scene::SceneParser::tag_lights() {
     Lights lights;
+    lights.shadowRays = attrToU32("shadow_rays", 0);
+    lights.cutoff = attrToScalar("cutoff", 0.0f);
+    if (lights.cutoff < 0.0f) {
+        throw std::runtime_error("the light cutoff must not be negative");
+    }
     while (!m_xml.nextTag().is("lights", Xml::TagType::End)) {
         if (tagIs("ambient_light", Xml::TagType::Start)) {
             lights.ambientLight = tag_light().power();
@@ -130,9 +177,12 @@ Light Scene::SceneParser::tag_light() {
     return Light(tagName == "parallel_light" ? Light::Type::Parallel : Light::Type::Point, position, color);
 }
 
-std::vector<Object> Scene::SceneParser::tag_surfaces() {
-    std::vector<Object> objects;
+Scene::SceneParser::Surfaces Scene::SceneParser::tag_surfaces() {
+    Surfaces surfaces;
+    std::vector<Object> &objects = surfaces.objects;
     while (!m_xml.nextTag().is("surfaces", Xml::TagType::End)) {
+        m_animated = false;
+        const size_t firstObject = objects.size();
         if (tagIs("sphere", Xml::TagType::Start)) {
             const scalar radius = attrToScalar("radius");
             ObjectInfo o = tag_object();
@@ -157,8 +207,11 @@ std::vector<Object> Scene::SceneParser::tag_surfaces() {
         } else {
             throw std::runtime_error("unknown tag in surfaces");
         }
+        if (m_animated) {
+            surfaces.animatedObjects.emplace_back(firstObject, objects.size());
+        }
     }
-    return objects;
+    return surfaces;
 }
 
 Scene::SceneParser::ObjectInfo Scene::SceneParser::tag_object() {
@@ -210,6 +263,7 @@ Material Scene::SceneParser::tag_material() {
             throw std::runtime_error("unknown tag in " + tagName);
         }
     }
+    material.classify();
     return material;
 }
 
@@ -273,7 +327,7 @@ const std::string &Scene::SceneParser::attrToString(const std::string &attrname)
     return m_xml.thisTag().attr(attrname);
 }
 
-const std::string &Scene::SceneParser::attrToString(const std::string &attrname, const std::string &defaultValue) const {
+std::string Scene::SceneParser::attrToString(const std::string &attrname, const std::string &defaultValue) const {
     auto it = m_xml.thisTag().attributes.find(attrname);
     if (it == m_xml.thisTag().attributes.end()) {
         return defaultValue;
@@ -306,6 +360,9 @@ u32 Scene::SceneParser::attrToU32(const std::string &attrname, u32 defaultValue)
 }
 
 scalar Scene::SceneParser::animateScalar(const std::string &attrValue) const {
+    if (attrValue.find(';') != std::string::npos) {
+        m_animated = true;
+    }
     // This splits animation strings into its components:
     // Example: "-1.0;1.0(n,0.5);2.0(o);3.0(0.9)"
     //   gets split into matches 0-3 with sub matches 0-4 (submatch 0 is always fully matched string)
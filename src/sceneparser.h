@@ -16,6 +16,12 @@ private:
     struct Lights {
         Power ambientLight;
         std::vector<Light> lights;
+        u32 shadowRays;
+        scalar cutoff;
+    };
+    struct Surfaces {
+        std::vector<Object> objects;
+        std::vector<ObjectRange> animatedObjects;
     };
     struct TransformInfo {
         // we have them separate for now to skip calculating the inverse
@@ -32,7 +38,7 @@ private:
     Camera tag_camera();
     Lights tag_lights();
     Light tag_light();
-    std::vector<Object> tag_surfaces();
+    Surfaces tag_surfaces();
     ObjectInfo tag_object();
     Material tag_material();
     TransformInfo tag_transform();
@@ -47,7 +53,8 @@ private:
     // either with defaultValue or throwing if attribute is missing
     // attrToScalar supports animations using m_time
     const std::string &attrToString(const std::string &attrname) const;
-    const std::string &attrToString(const std::string &attrname, const std::string &defaultValue) const;
+    // returns a copy, defaultValue may be a temporary
+    std::string attrToString(const std::string &attrname, const std::string &defaultValue) const;
     scalar attrToScalar(const std::string &attrname) const;
     scalar attrToScalar(const std::string &attrname, scalar defaultValue) const;
     u32 attrToU32(const std::string &attrname) const;
@@ -59,4 +66,6 @@ private:
     Xml m_xml;
     std::string m_sceneFileName;
     scalar m_time; // for animations - goes from 0.0f to 1.0f
+    // set by animateScalar() for values with more than one keyframe, to find the static parts of the scene
+    mutable bool m_animated = false;
 };
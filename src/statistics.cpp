@@ -0,0 +1,85 @@
+#include <array>
+#include <ostream>
+
+#include "statistics.h"
+
+static const std::array<const char *, Object::PrimitiveTypeCount> PrimitiveTypeNames{ "sphere", "triangle", "julia" };
+
+// times of the rendered tiles, unrendered tiles (of a partial rendering) have no time
+struct TileTimes {
+    u32 count = 0;
+    double min = 0.0;
+    double max = 0.0;
+    double sum = 0.0;
+    u32 slowestTile = 0;
+};
+
+static TileTimes summarizeTileTimes(const std::vector<double> &tileSeconds) {
+    TileTimes times;
+    for (size_t tile = 0; tile < tileSeconds.size(); tile++) {
+        const double seconds = tileSeconds[tile];
+        if (seconds > 0.0) {
+            if (times.count == 0 || seconds < times.min) {
+                times.min = seconds;
+            }
+            if (times.count == 0 || seconds > times.max) {
+                times.max = seconds;
+                times.slowestTile = static_cast<u32>(tile);
+            }
+            times.sum += seconds;
+            times.count++;
+        }
+    }
+    return times;
+}
+
+void printStatistics(std::ostream &out, const RenderStatistics &statistics) {
+    const RayTracer::Statistics &rt = statistics.raytracer;
+    out << "Phases: parse " << statistics.parseSeconds << " s, photon map " << statistics.photonMapSeconds
+        << " s, trace " << statistics.traceSeconds << " s, encode " << statistics.encodeSeconds << " s\n";
+    out << "Rays: " << rt.primaryRays << " primary, " << rt.shadowRays << " shadow (" << rt.cachedOccluders << " blocked by the cached occluder), "
+        << rt.reflectionRays << " reflection, " << rt.refractionRays << " refraction, "
+        << rt.culledRays << " culled because of low weight\n";
+    out << "Intersection tests:";
+    for (size_t i = 0; i < PrimitiveTypeNames.size(); i++) {
+        out << (i > 0 ? ", " : " ") << rt.intersectionTests[i] << " " << PrimitiveTypeNames[i];
+    }
+    out << " (" << rt.juliaMarchSteps << " julia march steps)\n";
+    if (statistics.photons > 0) {
+        out << "Photons: " << statistics.photons << "\n";
+    }
+    if (rt.reusedPixels > 0) {
+        out << "Reused pixels: " << rt.reusedPixels << " static pixels of motion blur subframes\n";
+    }
+    const TileTimes tileTimes = summarizeTileTimes(rt.tileSeconds);
+    if (tileTimes.count > 0) {
+        out << "Tile times: min " << tileTimes.min << " s, mean " << tileTimes.sum / tileTimes.count
+            << " s, max " << tileTimes.max << " s (tile " << tileTimes.slowestTile << ")\n";
+    }
+}
+
+void writeStatisticsJSON(std::ostream &out, const RenderStatistics &statistics) {
+    const RayTracer::Statistics &rt = statistics.raytracer;
+    out << "{\n";
+    out << "  \"seconds\": { \"total\": " << statistics.totalSeconds << ", \"parse\": " << statistics.parseSeconds
+        << ", \"photonMap\": " << statistics.photonMapSeconds << ", \"trace\": " << statistics.traceSeconds
+        << ", \"encode\": " << statistics.encodeSeconds << " },\n";
+    out << "  \"rays\": { \"primary\": " << rt.primaryRays << ", \"shadow\": " << rt.shadowRays << ", \"cachedOccluders\": " << rt.cachedOccluders
+        << ", \"reflection\": " << rt.reflectionRays << ", \"refraction\": " << rt.refractionRays
+        << ", \"culled\": " << rt.culledRays << " },\n";
+    out << "  \"intersectionTests\": {";
+    for (size_t i = 0; i < PrimitiveTypeNames.size(); i++) {
+        out << (i > 0 ? ", \"" : " \"") << PrimitiveTypeNames[i] << "\": " << rt.intersectionTests[i];
+    }
+    out << " },\n";
+    out << "  \"juliaMarchSteps\": " << rt.juliaMarchSteps << ",\n";
+    out << "  \"photons\": " << statistics.photons << ",\n";
+    out << "  \"reusedPixels\": " << rt.reusedPixels << ",\n";
+    // the tile times line by line as numbered by Picture::tiles()
+    out << "  \"tiles\": { \"columns\": " << rt.tiles.x << ", \"rows\": " << rt.tiles.y << ", \"seconds\": [";
+    for (size_t tile = 0; tile < rt.tileSeconds.size(); tile++) {
+        out << (tile > 0 ? ", " : "") << rt.tileSeconds[tile];
+    }
+    out << "] }\n";
+    out << "}\n";
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <ostream>
+
+#include "raytracer.h"
+
+// Statistics of a whole rendering (all frames and subframes),
+// printed as text and written as JSON for tracking performance regressions.
+struct RenderStatistics {
+    RayTracer::Statistics raytracer;
+    u64 photons = 0; // stored by the photon mapper
+    // wall clock times of the phases in seconds
+    double totalSeconds = 0.0;
+    double parseSeconds = 0.0; // loading the scene files
+    double photonMapSeconds = 0.0;
+    double traceSeconds = 0.0;
+    double encodeSeconds = 0.0; // animations encode in a background thread while tracing
+};
+
+// adds the time until its destruction to a phase time
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double &seconds) :
+        m_seconds{ seconds },
+        m_beginTime{ std::chrono::steady_clock::now() }
+    {}
+    ~PhaseTimer() {
+        m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_beginTime).count();
+    }
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    double &m_seconds;
+    const std::chrono::steady_clock::time_point m_beginTime;
+};
+
+void printStatistics(std::ostream &out, const RenderStatistics &statistics);
+void writeStatisticsJSON(std::ostream &out, const RenderStatistics &statistics);
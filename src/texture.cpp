@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "texture.h"
+
+Texture::Texture(UDim2 size, const std::vector<UColor> &texels) {
+    auto data = std::make_shared<Data>();
+    data->levels.push_back(makeLevel(size, texels));
+
+    // Mip pyramid: every level halves the size of the previous one
+    //   by averaging 2x2 texels (the last line/column is repeated for odd sizes)
+    //   until it is 1x1.
+    std::vector<UColor> levelTexels = texels;
+    while (size.x > 1 || size.y > 1) {
+        const UDim2 nextSize{ std::max(size.x / 2, 1u), std::max(size.y / 2, 1u) };
+        std::vector<UColor> nextTexels(static_cast<size_t>(nextSize.x) * nextSize.y);
+        for (u32 y = 0; y < nextSize.y; y++) {
+            const u32 y0 = std::min(2 * y, size.y - 1);
+            const u32 y1 = std::min(2 * y + 1, size.y - 1);
+            for (u32 x = 0; x < nextSize.x; x++) {
+                const u32 x0 = std::min(2 * x, size.x - 1);
+                const u32 x1 = std::min(2 * x + 1, size.x - 1);
+                const std::array<UColor, 4> quad{
+                    levelTexels[static_cast<size_t>(y0) * size.x + x0],
+                    levelTexels[static_cast<size_t>(y0) * size.x + x1],
+                    levelTexels[static_cast<size_t>(y1) * size.x + x0],
+                    levelTexels[static_cast<size_t>(y1) * size.x + x1]
+                };
+                auto average = [&quad] (u8 UColor::*channel) {
+                    return static_cast<u8>((quad[0].*channel + quad[1].*channel + quad[2].*channel + quad[3].*channel + 2) / 4);
+                };
+                nextTexels[static_cast<size_t>(y) * nextSize.x + x] = UColor{
+                    average(&UColor::r), average(&UColor::g), average(&UColor::b), average(&UColor::a)
+                };
+            }
+        }
+        size = nextSize;
+        levelTexels = std::move(nextTexels);
+        data->levels.push_back(makeLevel(size, levelTexels));
+    }
+
+    m_data = std::move(data);
+}
+
+Texture::Level Texture::makeLevel(UDim2 size, const std::vector<UColor> &texels) {
+    Level level;
+    level.size = size;
+    level.tilesPerLine = (size.x + TILE_SIZE - 1) / TILE_SIZE;
+    const u32 tileLines = (size.y + TILE_SIZE - 1) / TILE_SIZE;
+    level.texels.resize(static_cast<size_t>(level.tilesPerLine) * tileLines * TILE_SIZE * TILE_SIZE);
+    for (u32 y = 0; y < size.y; y++) {
+        for (u32 x = 0; x < size.x; x++) {
+            const size_t tile = static_cast<size_t>(y / TILE_SIZE) * level.tilesPerLine + x / TILE_SIZE;
+            level.texels[tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] =
+                texels[static_cast<size_t>(y) * size.x + x];
+        }
+    }
+    return level;
+}
+
+Color Texture::sample(Point2 coord, scalar lod) const {
+    if (!(lod > 0.0f)) {
+        return sample(coord);
+    }
+    lod = std::min(lod, static_cast<scalar>(m_data->levels.size() - 1));
+    const u32 level = static_cast<u32>(lod);
+    const scalar levelFactor = lod - level;
+    const Color color = sampleLevel(m_data->levels[level], coord);
+    if (levelFactor == 0.0f) {
+        return color;
+    }
+    return color * (1.0f - levelFactor) + sampleLevel(m_data->levels[level + 1], coord) * levelFactor;
+}
+
+Color Texture::sampleLevel(const Level &level, Point2 coord) {
+    // The texture is in repeat mode -> only use fractional part
+    const Point2 texel{
+        (coord.x - std::floor(coord.x)) * (level.size.x - 1),
+        (coord.y - std::floor(coord.y)) * (level.size.y - 1)
+    };
+    const u32 x0 = std::min(static_cast<u32>(texel.x), level.size.x - 1);
+    const u32 y0 = std::min(static_cast<u32>(texel.y), level.size.y - 1);
+    const u32 x1 = std::min(x0 + 1, level.size.x - 1);
+    const u32 y1 = std::min(y0 + 1, level.size.y - 1);
+    const scalar fx = texel.x - x0;
+    const scalar fy = texel.y - y0;
+
+    return Color(level.get(x0, y0)) * ((1 - fx) * (1 - fy)) +
+        Color(level.get(x1, y0)) * (fx * (1 - fy)) +
+        Color(level.get(x0, y1)) * ((1 - fx) * fy) +
+        Color(level.get(x1, y1)) * (fx * fy);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "types.h"
+
+// Read-only RGBA8 texture with a precomputed mip pyramid.
+// The texels of every level are stored in tiles of 4x4 texels,
+// so the 4 texels of a bilinear lookup are mostly in the same cache line.
+// The texture data is shared between copies, as every object has its own material copy.
+class Texture {
+public:
+    Texture() = default;
+    Texture(UDim2 size, const std::vector<UColor> &texels);
+
+    bool empty() const { return !m_data; }
+    UDim2 size() const { return empty() ? UDim2{ 0, 0 } : m_data->levels.front().size; }
+    u32 levels() const { return empty() ? 0 : static_cast<u32>(m_data->levels.size()); }
+
+    // bilinear filtered lookup in repeat mode of the full resolution level
+    Color sample(Point2 coord) const { return sampleLevel(m_data->levels.front(), coord); }
+    // trilinear filtered lookup, lod is the level of detail (log2 of the texel footprint in level 0 texels)
+    Color sample(Point2 coord, scalar lod) const;
+
+private:
+    static constexpr u32 TILE_SIZE = 4;
+
+    struct Level {
+        UDim2 size;
+        u32 tilesPerLine;
+        std::vector<UColor> texels;
+
+        UColor get(u32 x, u32 y) const {
+            const size_t tile = static_cast<size_t>(y / TILE_SIZE) * tilesPerLine + x / TILE_SIZE;
+            return texels[tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+        }
+    };
+
+    struct Data {
+        std::vector<Level> levels;
+    };
+
+    static Level makeLevel(UDim2 size, const std::vector<UColor> &texels);
+    static Color sampleLevel(const Level &level, Point2 coord);
+
+    std::shared_ptr<const Data> m_data;
+};
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "binfilehelper.h"
+#include "tiles.h"
+
+static const std::array<char, 8> TileFileMagic{ 'R', 'T', 'T', 'I', 'L', 'E', 'S', 1 };
+// largest picture of a tile file (16384 x 16384, 4 GB of values), the size is read before the checksum
+static const u64 MAX_TILE_FILE_PIXELS = static_cast<u64>(1) << 28;
+
+// parses an unsigned number, the whole string must be used
+static u32 parseNumber(const std::string &text) {
+    size_t end = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &end);
+    } catch (const std::exception &) {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || text[0] == '-' || value > std::numeric_limits<u32>::max()) {
+        throw std::runtime_error("invalid number: '" + text + "'");
+    }
+    return static_cast<u32>(value);
+}
+
+static std::vector<std::string> split(const std::string &text, char separator) {
+    std::vector<std::string> parts;
+    std::istringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+std::vector<u32> parseNumberList(const std::string &list, u64 count) {
+    std::vector<u32> numbers;
+    for (const std::string &range : split(list, ',')) {
+        const size_t dash = range.find('-');
+        const u32 first = parseNumber(dash == std::string::npos ? range : range.substr(0, dash));
+        const u32 last = dash == std::string::npos ? first : parseNumber(range.substr(dash + 1));
+        if (last < first) {
+            throw std::runtime_error("invalid range: '" + range + "'");
+        }
+        // checked before expanding, so a huge range cannot exhaust the memory
+        if (last >= count) {
+            throw std::runtime_error("number out of range: '" + range + "'");
+        }
+        for (u64 number = first; number <= last; number++) {
+            numbers.push_back(static_cast<u32>(number));
+        }
+    }
+    if (numbers.empty()) {
+        throw std::runtime_error("empty list");
+    }
+    // remove duplicates, so nothing is rendered twice
+    std::sort(numbers.begin(), numbers.end());
+    numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+    return numbers;
+}
+
+std::string formatNumberList(std::vector<u32> numbers) {
+    std::sort(numbers.begin(), numbers.end());
+    numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+    std::ostringstream out;
+    for (size_t i = 0; i < numbers.size();) {
+        size_t last = i;
+        while (last + 1 < numbers.size() && numbers[last + 1] == numbers[last] + 1) {
+            last++;
+        }
+        out << (i > 0 ? "," : "") << numbers[i];
+        if (last > i) {
+            out << "-" << numbers[last];
+        }
+        i = last + 1;
+    }
+    return out.str();
+}
+
+std::vector<u32> parseShard(const std::string &shard, u32 total) {
+    const std::vector<std::string> parts = split(shard, '/');
+    if (parts.size() != 2) {
+        throw std::runtime_error("invalid shard: '" + shard + "', expected index/count");
+    }
+    const u32 index = parseNumber(parts[0]);
+    const u32 count = parseNumber(parts[1]);
+    if (index >= count) {
+        throw std::runtime_error("invalid shard: '" + shard + "', index must be lower than count");
+    }
+    // round robin, so every shard gets easy and hard parts (e.g. of an animation)
+    std::vector<u32> numbers;
+    for (u32 number = index; number < total; number += count) {
+        numbers.push_back(number);
+    }
+    if (numbers.empty()) {
+        throw std::runtime_error("shard " + shard + " is empty");
+    }
+    return numbers;
+}
+
+u64 pictureTileCount(UDim2 pictureSize) {
+    return static_cast<u64>(Picture::tilesFor(pictureSize.x)) * Picture::tilesFor(pictureSize.y);
+}
+
+PictureRegion parseRegion(const std::string &region) {
+    const std::vector<std::string> parts = split(region, ',');
+    if (parts.size() != 4) {
+        throw std::runtime_error("invalid region: '" + region + "', expected x,y,width,height");
+    }
+    return PictureRegion{ { parseNumber(parts[0]), parseNumber(parts[1]) }, { parseNumber(parts[2]), parseNumber(parts[3]) } };
+}
+
+// throws if the region is not completely inside the picture
+static void checkRegion(UDim2 size, const PictureRegion &region) {
+    if (region.size.x == 0 || region.size.y == 0 ||
+        region.origin.x >= size.x || region.size.x > size.x - region.origin.x ||
+        region.origin.y >= size.y || region.size.y > size.y - region.origin.y) {
+        throw std::runtime_error("region outside of the picture");
+    }
+}
+
+std::vector<u32> regionTiles(UDim2 pictureSize, const PictureRegion &region) {
+    checkRegion(pictureSize, region);
+    const u32 tilesPerLine = Picture::tilesFor(pictureSize.x);
+    const u32 firstX = region.origin.x / Picture::TILE_SIZE;
+    const u32 firstY = region.origin.y / Picture::TILE_SIZE;
+    const u32 lastX = (region.origin.x + region.size.x - 1) / Picture::TILE_SIZE;
+    const u32 lastY = (region.origin.y + region.size.y - 1) / Picture::TILE_SIZE;
+    std::vector<u32> tiles;
+    for (u32 y = firstY; y <= lastY; y++) {
+        for (u32 x = firstX; x <= lastX; x++) {
+            tiles.push_back(y * tilesPerLine + x);
+        }
+    }
+    return tiles;
+}
+
+Picture cropPicture(const Picture &picture, const PictureRegion &region) {
+    checkRegion(picture.size(), region);
+    Picture cropped(region.size);
+    for (u32 y = 0; y < region.size.y; y++) {
+        for (u32 x = 0; x < region.size.x; x++) {
+            cropped.set({ x, y }, picture.get({ region.origin.x + x, region.origin.y + y }));
+        }
+    }
+    return cropped;
+}
+
+// The tile file is stored in little endian byte order:
+//   magic, u32 width, u32 height, u32 tile size, u32 tile count,
+//   for each tile: u32 tile number, TILE_VALUES floats (plane by plane),
+//   u32 crc32 of everything after the magic.
+void checkTilePictureSize(UDim2 size) {
+    if (size.x == 0 || size.y == 0 || size.x > std::numeric_limits<u32>::max() - (Picture::TILE_SIZE - 1) ||
+        size.y > std::numeric_limits<u32>::max() - (Picture::TILE_SIZE - 1) ||
+        static_cast<u64>(size.x) * size.y > MAX_TILE_FILE_PIXELS) {
+        throw std::runtime_error("invalid picture size for a tile file: " + std::to_string(size.x) + "x" + std::to_string(size.y));
+    }
+}
+
+void writeTiles(std::ostream &out, const Picture &picture, const std::vector<u32> &tiles) {
+    checkTilePictureSize(picture.size());
+    out.write(TileFileMagic.data(), TileFileMagic.size());
+    LittleEndianWriter writer(out);
+    writer.write(picture.size().x);
+    writer.write(picture.size().y);
+    writer.write(Picture::TILE_SIZE);
+    writer.write(static_cast<u32>(tiles.size()));
+    std::vector<scalar> values(Picture::TILE_VALUES);
+    for (u32 tile : tiles) {
+        writer.write(tile);
+        picture.getTile(tile, values.data());
+        writer.write(values.data(), values.size());
+    }
+    writer.write(writer.getAndResetCRC());
+    if (!out) {
+        throw std::runtime_error("tile file could not be written");
+    }
+}
+
+// bytes from the current position to the end of the stream
+static u64 remainingSize(std::istream &in) {
+    const std::streampos position = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streampos end = in.tellg();
+    in.seekg(position);
+    if (position < 0 || end < position || !in) {
+        throw std::runtime_error("tile file size unknown");
+    }
+    return static_cast<u64>(end - position);
+}
+
+std::vector<u32> readTiles(std::istream &in, Picture &picture) {
+    std::array<char, 8> magic;
+    if (!in.read(magic.data(), magic.size()) || magic != TileFileMagic) {
+        throw std::runtime_error("wrong tile file header");
+    }
+    LittleEndianReader reader(in);
+    const UDim2 size{ reader.readU32(), reader.readU32() };
+    // checked before anything depends on it, Picture(size) would allocate it
+    checkTilePictureSize(size);
+    if (reader.readU32() != Picture::TILE_SIZE) {
+        throw std::runtime_error("unsupported tile size in tile file");
+    }
+    const u32 tileCount = reader.readU32();
+    const u64 pictureTiles = pictureTileCount(size);
+    if (tileCount > pictureTiles) {
+        throw std::runtime_error("too many tiles in tile file");
+    }
+    // the sizes are checked against the file length before allocating, as the checksum is at the end
+    const u64 dataSize = static_cast<u64>(tileCount) * (sizeof(u32) + Picture::TILE_VALUES * sizeof(scalar)) + sizeof(u32);
+    if (remainingSize(in) < dataSize) {
+        throw std::runtime_error("tile file truncated");
+    }
+    std::vector<u32> tiles(tileCount);
+    std::vector<scalar> values(static_cast<size_t>(tileCount) * Picture::TILE_VALUES);
+    for (u32 i = 0; i < tileCount; i++) {
+        tiles[i] = reader.readU32();
+        if (tiles[i] >= pictureTiles) {
+            throw std::runtime_error("tile number out of range in tile file");
+        }
+        reader.read(&values[i * Picture::TILE_VALUES], Picture::TILE_VALUES);
+    }
+    const u32 checksum = reader.getAndResetCRC();
+    if (reader.readU32() != checksum) {
+        throw std::runtime_error("tile file checksum wrong");
+    }
+
+    // the picture is only changed after the whole file is validated
+    if (picture.empty()) {
+        picture = Picture(size);
+    } else if (picture.size().x != size.x || picture.size().y != size.y) {
+        throw std::runtime_error("tile file has a different picture size");
+    }
+    for (u32 i = 0; i < tileCount; i++) {
+        picture.setTile(tiles[i], &values[i * Picture::TILE_VALUES]);
+    }
+    return tiles;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Partial rendering results for splitting one picture across several processes.
+// The tiles are numbered line by line as in Picture::tiles().
+
+struct PictureRegion {
+    UPoint2 origin;
+    UDim2 size;
+};
+
+// list of tile or frame numbers like "0-15,20,31-40", all numbers must be lower than count
+std::vector<u32> parseNumberList(const std::string &list, u64 count);
+// sorted compact number list in the format of parseNumberList()
+std::string formatNumberList(std::vector<u32> numbers);
+// shard like "index/count": every count-th number of 0..total-1 starting with index
+std::vector<u32> parseShard(const std::string &shard, u32 total);
+
+// number of tiles of a picture, 64 bit for untrusted sizes
+u64 pictureTileCount(UDim2 pictureSize);
+
+// region like "x,y,width,height"
+PictureRegion parseRegion(const std::string &region);
+// tiles covering the region
+std::vector<u32> regionTiles(UDim2 pictureSize, const PictureRegion &region);
+Picture cropPicture(const Picture &picture, const PictureRegion &region);
+
+// Tile file: the raw float values of the listed tiles with a checksum.
+// Throws if a picture of this size cannot be stored in a tile file (empty or more than 16384 x 16384 pixels).
+void checkTilePictureSize(UDim2 size);
+void writeTiles(std::ostream &out, const Picture &picture, const std::vector<u32> &tiles);
+// Reads the tiles of a tile file into picture, which is created if it is empty
+//   or must have the same size otherwise. Returns the tile numbers read.
+std::vector<u32> readTiles(std::istream &in, Picture &picture);
@@ -5,11 +5,14 @@
 #include <cassert>
 #include <cmath>
 #include <limits>
+#include <new>
+#include <stdexcept>
 #include <vector>
 
 using u8 = unsigned char;
 using u16 = unsigned short;
 using u32 = unsigned int;
+using u64 = unsigned long long;
 
 using scalar = float;
 //constexpr scalar operator"" _s(long double v) {
@@ -52,6 +55,9 @@ struct Vector2 {
     Vector2 operator+(Vector2 rhs) const {
         return { x + rhs.x, y + rhs.y };
     }
+    Vector2 operator-(Vector2 rhs) const {
+        return { x - rhs.x, y - rhs.y };
+    }
     Vector2 operator*(scalar rhs) const {
         return { x * rhs, y * rhs };
     }
@@ -106,6 +112,10 @@ struct Vector3 {
     friend Vector3 operator/(const scalar &lhs, const Vector3 &rhs) {
         return { lhs / rhs.x, lhs / rhs.y, lhs / rhs.z };
     }
+    bool operator==(const Vector3 &rhs) const {
+        return x == rhs.x && y == rhs.y && z == rhs.z;
+    }
+    bool operator!=(const Vector3 &rhs) const { return !operator==(rhs); }
 };
 using Point3 = Vector3;
 using Dim3 = Vector3;
@@ -201,6 +211,21 @@ struct Matrix34 {
         };
     }
 
+    // returns the scale factor if this matrix only rotates, translates and scales uniformly
+    // or 0 if it contains non-uniform scaling or shearing
+    scalar uniformScale() const {
+        const Vector3 col0{ m[0][0], m[1][0], m[2][0] };
+        const Vector3 col1{ m[0][1], m[1][1], m[2][1] };
+        const Vector3 col2{ m[0][2], m[1][2], m[2][2] };
+        const scalar squaredScale = col0.dot(col0);
+        const scalar tolerance = squaredScale * 1e-5f;
+        if (fabsf(col1.dot(col1) - squaredScale) > tolerance || fabsf(col2.dot(col2) - squaredScale) > tolerance ||
+            fabsf(col0.dot(col1)) > tolerance || fabsf(col0.dot(col2)) > tolerance || fabsf(col1.dot(col2)) > tolerance) {
+            return 0.0f;
+        }
+        return sqrtf(squaredScale);
+    }
+
     Matrix34 operator*(const Matrix34 &rhs) const {
         Matrix34 ret;
         for (u8 r = 0; r < 3; r++) {
@@ -218,6 +243,65 @@ struct Matrix34 {
         }
         return ret;
     }
+
+    // inverse of an affine transformation with an invertible 3x3 part
+    Matrix34 inverse() const {
+        // adjugate of the 3x3 part divided by the determinant
+        const scalar c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        const scalar c01 = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+        const scalar c02 = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+        const scalar c10 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        const scalar c11 = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+        const scalar c12 = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+        const scalar c20 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        const scalar c21 = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+        const scalar c22 = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+        const scalar invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c10 + m[0][2] * c20);
+        Matrix34 ret{
+            c00 * invDet, c01 * invDet, c02 * invDet, 0,
+            c10 * invDet, c11 * invDet, c12 * invDet, 0,
+            c20 * invDet, c21 * invDet, c22 * invDet, 0
+        };
+        // the translation gets undone after the 3x3 part
+        const Vector3 translation = ret.mulWithoutTranslate(Vector3{ m[0][3], m[1][3], m[2][3] });
+        ret.m[0][3] = -translation.x;
+        ret.m[1][3] = -translation.y;
+        ret.m[2][3] = -translation.z;
+        return ret;
+    }
+
+    // transposed 3x3 part without translation, inverse().transposed() transforms the normals
+    Matrix34 transposed() const {
+        return {
+            m[0][0], m[1][0], m[2][0], 0,
+            m[0][1], m[1][1], m[2][1], 0,
+            m[0][2], m[1][2], m[2][2], 0
+        };
+    }
+
+    // element-wise, for interpolating matrices
+    Matrix34 operator+(const Matrix34 &rhs) const {
+        Matrix34 ret;
+        for (u8 r = 0; r < 3; r++) {
+            for (u8 c = 0; c < 4; c++) {
+                ret.m[r][c] = m[r][c] + rhs.m[r][c];
+            }
+        }
+        return ret;
+    }
+    Matrix34 operator*(scalar rhs) const {
+        Matrix34 ret;
+        for (u8 r = 0; r < 3; r++) {
+            for (u8 c = 0; c < 4; c++) {
+                ret.m[r][c] = m[r][c] * rhs;
+            }
+        }
+        return ret;
+    }
+    bool operator==(const Matrix34 &rhs) const {
+        return std::equal(&m[0][0], &m[0][0] + 12, &rhs.m[0][0]);
+    }
+    bool operator!=(const Matrix34 &rhs) const { return !operator==(rhs); }
 };
 
 struct Quaternion {
@@ -252,6 +336,16 @@ struct Quaternion {
         };
     }
 
+    // z * z simplified, the cross product terms of the Hamilton product cancel out
+    Quaternion squared() const {
+        return {
+            r * r - a * a - b * b - c * c,
+            2.0f * r * a,
+            2.0f * r * b,
+            2.0f * r * c
+        };
+    }
+
     // Calculate length, but skip the sqrt step
     // used for optimized algorithm of
     // fractal distance estimator
@@ -261,8 +355,18 @@ struct Quaternion {
     scalar length() const {
         return sqrt(squaredLength());
     }
+    bool operator==(const Quaternion &rhs) const {
+        return r == rhs.r && a == rhs.a && b == rhs.b && c == rhs.c;
+    }
+    bool operator!=(const Quaternion &rhs) const { return !operator==(rhs); }
 };
 
+// linear interpolation from a (t = 0) to b (t = 1)
+template <typename T>
+T lerp(const T &a, const T &b, scalar t) {
+    return a * (1.0f - t) + b * t;
+}
+
 struct Color {
     scalar r, g, b, a;
 
@@ -302,6 +406,10 @@ struct Color {
     Color withoutAlpha() const {
         return { r, g, b, 1.0f };
     }
+    // perceived brightness (Rec. 709 weights)
+    scalar luminance() const {
+        return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    }
 };
 
 using Radiance = Color;
@@ -338,6 +446,14 @@ inline Color HSVtoRGB(float H, float S, float V) {
     return Color{ R, G, B };
 }
 
+// Ray differential according
+//   Igehy, H, 1999. Tracing Ray Differentials. SIGGRAPH '99, pp.179-186.
+// Change of ray origin and direction when moving the camera sample by one subpixel along one image axis.
+struct RayDifferential {
+    Vector3 origin{ 0.0f, 0.0f, 0.0f };
+    Vector3 direction{ 0.0f, 0.0f, 0.0f };
+};
+
 class Ray {
 public:
     Ray(Point3 origin, Vector3 direction) :
@@ -347,43 +463,228 @@ public:
 
     const Point3 &origin() const { return m_origin; }
     const Vector3 &direction() const { return m_direction; }
+    // point in the shutter time of motion blur from 0 (open) to 1 (close), secondary rays inherit it
+    scalar time() const { return m_time; }
+    void setTime(scalar time) { m_time = time; }
 
     void addOffset(Vector3 offset) { m_origin = m_origin + offset; }
 
+    // The differentials for the x and y image axis approximate the footprint of the subpixel the ray belongs to.
+    //   A ray without differentials (all 0) asks for full precision.
+    const std::array<RayDifferential, 2> &differentials() const { return m_differentials; }
+    void setDifferentials(const std::array<RayDifferential, 2> &differentials) { m_differentials = differentials; }
+    // width of the footprint at the given distance along the ray
+    scalar footprint(scalar distance) const {
+        return std::max((m_differentials[0].origin + m_differentials[0].direction * distance).length(),
+            (m_differentials[1].origin + m_differentials[1].direction * distance).length());
+    }
+    // growth of the footprint width per distance unit
+    scalar footprintSpread() const {
+        return std::max(m_differentials[0].direction.length(), m_differentials[1].direction.length());
+    }
+    // Transfer the differentials to the hit point at distance on a surface with the given normal:
+    //   returns the origin differentials of rays starting there, the directions are kept.
+    std::array<RayDifferential, 2> transferDifferentials(scalar distance, const Vector3 &normal) const {
+        std::array<RayDifferential, 2> transferred = m_differentials;
+        const scalar cos_angle_ray_normal = m_direction.dot(normal);
+        for (RayDifferential &differential : transferred) {
+            differential.origin = differential.origin + differential.direction * distance;
+            // move the point back onto the tangent plane of the surface (not for grazing hits)
+            if (fabsf(cos_angle_ray_normal) > EPSILON) {
+                differential.origin = differential.origin - m_direction * (differential.origin.dot(normal) / cos_angle_ray_normal);
+            }
+        }
+        return transferred;
+    }
+
 private:
     Point3 m_origin;
     Vector3 m_direction;
+    scalar m_time = 0.0f;
+    std::array<RayDifferential, 2> m_differentials;
 };
 
+// axis aligned bounding box, empty by default
+struct BoundingBox {
+    Point3 min{ INFINITE, INFINITE, INFINITE };
+    Point3 max{ -INFINITE, -INFINITE, -INFINITE };
+
+    void extend(const Point3 &point) {
+        min = { std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z) };
+        max = { std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z) };
+    }
+    void extend(const BoundingBox &box) {
+        extend(box.min);
+        extend(box.max);
+    }
+    // slab test of the ray up to max_distance, also true for ray origins inside the box
+    bool intersects(const Ray &ray, scalar max_distance) const {
+        scalar near = 0.0f;
+        scalar far = max_distance;
+        const std::array<scalar, 3> origin{ ray.origin().x, ray.origin().y, ray.origin().z };
+        const std::array<scalar, 3> direction{ ray.direction().x, ray.direction().y, ray.direction().z };
+        const std::array<scalar, 3> boxMin{ min.x, min.y, min.z };
+        const std::array<scalar, 3> boxMax{ max.x, max.y, max.z };
+        for (size_t axis = 0; axis < 3; axis++) {
+            if (direction[axis] == 0.0f) {
+                // parallel to the slab
+                if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis]) {
+                    return false;
+                }
+                continue;
+            }
+            scalar t1 = (boxMin[axis] - origin[axis]) / direction[axis];
+            scalar t2 = (boxMax[axis] - origin[axis]) / direction[axis];
+            if (t1 > t2) {
+                std::swap(t1, t2);
+            }
+            near = std::max(near, t1);
+            far = std::min(far, t2);
+            if (near > far) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Allocator for cache line aligned memory,
+//   so that separately used parts of a buffer do not share cache lines.
+template <typename T>
+struct CacheAlignedAllocator {
+    static constexpr size_t ALIGNMENT = 64;
+    using value_type = T;
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{ ALIGNMENT })); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t{ ALIGNMENT }); }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U> &) const { return false; }
+};
+
+// Framebuffer of radiance values.
+// The pixels are stored in tiles of TILE_SIZE x TILE_SIZE pixels and
+//   every color channel in a separate plane (structure of arrays).
+//   A line of a tile in a plane is exactly one cache line, so threads rendering
+//   different tiles never write into the same cache line,
+//   and the operations on whole pictures are simple loops which get vectorized.
 class Picture {
 public:
-    Picture() : m_size{ 0, 0 } {}
+    static constexpr u32 TILE_SIZE = 16;
+    static constexpr size_t PLANES = 4; // r, g, b, a
+    // number of values of one tile in all planes
+    static constexpr size_t TILE_VALUES = static_cast<size_t>(TILE_SIZE) * TILE_SIZE * PLANES;
+
+    Picture() : Picture(UDim2{ 0, 0 }) {}
+
+    // tiles needed for pixels, calculated in 64 bit so sizes near the u32 limit do not wrap
+    static u32 tilesFor(u32 pixels) {
+        return static_cast<u32>((static_cast<u64>(pixels) + TILE_SIZE - 1) / TILE_SIZE);
+    }
 
     Picture(UDim2 size) :
         m_size{ size },
-        m_data{ static_cast<size_t>(size.x) * size.y }
+        m_tiles{ tilesFor(size.x), tilesFor(size.y) },
+        m_planeSize{ static_cast<size_t>(m_tiles.x) * m_tiles.y * TILE_SIZE * TILE_SIZE },
+        m_data(m_planeSize * PLANES)
     {}
 
     Picture(UDim2 size, Radiance background) :
-        m_size{ size },
-        m_data{ static_cast<size_t>(size.x) * size.y, background }
-    {}
+        Picture(size)
+    {
+        const std::array<scalar, PLANES> values{ background.r, background.g, background.b, background.a };
+        for (size_t plane = 0; plane < PLANES; plane++) {
+            std::fill_n(m_data.begin() + plane * m_planeSize, m_planeSize, values[plane]);
+        }
+    }
 
     void mulAdd(const Picture &rhs, scalar factor) {
+        assert(rhs.m_data.size() == m_data.size());
+        scalar *data = m_data.data();
+        const scalar *rhsData = rhs.m_data.data();
         for (size_t i = 0; i < m_data.size(); i++) {
-            m_data[i] += rhs.m_data[i] * factor;
+            data[i] += rhsData[i] * factor;
+        }
+    }
+
+    void scale(scalar factor) {
+        for (scalar &value : m_data) {
+            value *= factor;
+        }
+    }
+
+    // Convert a line to 8 bit colors, like Color::scaleOut(), out needs space for size().x colors.
+    void scaleOutLine(u32 y, scalar gain, UColor *out) const {
+        const size_t lineStart = static_cast<size_t>(y / TILE_SIZE) * m_tiles.x * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE;
+        for (u32 tileX = 0; tileX < m_tiles.x; tileX++) {
+            const size_t start = lineStart + static_cast<size_t>(tileX) * TILE_SIZE * TILE_SIZE;
+            std::array<std::array<u8, TILE_SIZE>, PLANES> converted;
+            for (size_t plane = 0; plane < PLANES; plane++) {
+                const scalar *values = &m_data[plane * m_planeSize + start];
+                for (u32 i = 0; i < TILE_SIZE; i++) {
+                    converted[plane][i] = static_cast<u8>(std::clamp(values[i] * gain, 0.0f, 1.0f) * 255.0f);
+                }
+            }
+            const u32 count = std::min(TILE_SIZE, m_size.x - tileX * TILE_SIZE);
+            for (u32 i = 0; i < count; i++) {
+                out[tileX * TILE_SIZE + i] = UColor{ converted[0][i], converted[1][i], converted[2][i], converted[3][i] };
+            }
+        }
+    }
+
+    // Copy a line of unclamped radiance values multiplied by gain, out needs space for size().x values.
+    void getLine(u32 y, scalar gain, Radiance *out) const {
+        const size_t lineStart = static_cast<size_t>(y / TILE_SIZE) * m_tiles.x * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE;
+        for (u32 x = 0; x < m_size.x; x++) {
+            const size_t i = lineStart + static_cast<size_t>(x / TILE_SIZE) * TILE_SIZE * TILE_SIZE + x % TILE_SIZE;
+            out[x] = Radiance{ m_data[i] * gain, m_data[i + m_planeSize] * gain,
+                m_data[i + 2 * m_planeSize] * gain, m_data[i + 3 * m_planeSize] * gain };
+        }
+    }
+
+    // Copy all values of a tile (plane by plane) from/to a buffer of TILE_VALUES scalars.
+    void getTile(u32 tile, scalar *out) const {
+        for (size_t plane = 0; plane < PLANES; plane++) {
+            std::copy_n(&m_data[plane * m_planeSize + static_cast<size_t>(tile) * TILE_SIZE * TILE_SIZE], TILE_SIZE * TILE_SIZE,
+                out + plane * TILE_SIZE * TILE_SIZE);
+        }
+    }
+    void setTile(u32 tile, const scalar *in) {
+        for (size_t plane = 0; plane < PLANES; plane++) {
+            std::copy_n(in + plane * TILE_SIZE * TILE_SIZE, TILE_SIZE * TILE_SIZE,
+                &m_data[plane * m_planeSize + static_cast<size_t>(tile) * TILE_SIZE * TILE_SIZE]);
         }
     }
 
     const UDim2 &size() const { return m_size; }
-    const Radiance &get(const UPoint2 &pos) const { return m_data[datapos(pos)]; }
-    void set(const UPoint2 &pos, const Radiance &radiance) { m_data[datapos(pos)] = radiance; }
-    //const std::vector<Radiance> &data() const { return m_data; }
+    const UDim2 &tiles() const { return m_tiles; }
+    Radiance get(const UPoint2 &pos) const {
+        const size_t i = datapos(pos);
+        return { m_data[i], m_data[i + m_planeSize], m_data[i + 2 * m_planeSize], m_data[i + 3 * m_planeSize] };
+    }
+    void set(const UPoint2 &pos, const Radiance &radiance) {
+        const size_t i = datapos(pos);
+        m_data[i] = radiance.r;
+        m_data[i + m_planeSize] = radiance.g;
+        m_data[i + 2 * m_planeSize] = radiance.b;
+        m_data[i + 3 * m_planeSize] = radiance.a;
+    }
     bool empty() const { return m_size.x == 0 || m_size.y == 0; }
 
 private:
-    size_t datapos(const UPoint2 &pos) const { return static_cast<size_t>(pos.y) * m_size.x + pos.x; }
+    size_t datapos(const UPoint2 &pos) const {
+        const size_t tile = static_cast<size_t>(pos.y / TILE_SIZE) * m_tiles.x + pos.x / TILE_SIZE;
+        return tile * TILE_SIZE * TILE_SIZE + (pos.y % TILE_SIZE) * TILE_SIZE + pos.x % TILE_SIZE;
+    }
 
     UDim2 m_size;
-    std::vector<Radiance> m_data;
+    UDim2 m_tiles;
+    size_t m_planeSize;
+    std::vector<scalar, CacheAlignedAllocator<scalar>> m_data;
 };
@@ -0,0 +1,269 @@
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "../src/png.h"
+
+// Decodes small PNG files of all color types, bit depths and both interlace modes
+// and compares the texels with known colors. The files are made by the simple encoder
+// below, which cycles through all filter types line by line.
+
+struct TestCase {
+    std::string name;
+    u8 colorType;
+    u8 bitDepth;
+    std::function<std::vector<u16>(u32 x, u32 y)> samples; // raw samples of a pixel
+    std::function<UColor(u32 x, u32 y)> expected;
+    std::vector<u8> palette{}; // PLTE chunk data
+    std::vector<u8> transparency{}; // tRNS chunk data
+};
+
+static u32 channels(u8 colorType) {
+    switch (colorType) {
+    case 2:
+        return 3;
+    case 4:
+        return 2;
+    case 6:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+static void appendU32(std::string &out, u32 value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+static void appendChunk(std::string &out, const std::string &type, const std::string &data) {
+    appendU32(out, static_cast<u32>(data.size()));
+    const std::string typeAndData = type + data;
+    out += typeAndData;
+    appendU32(out, static_cast<u32>(crc32(0L, reinterpret_cast<const Bytef *>(typeAndData.data()), static_cast<uInt>(typeAndData.size()))));
+}
+
+// the predictor as written in the PNG standard
+static int paethPredictor(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// bytes of one line of the pixels x = xStart, xStart + xStep, ... of line y, samples below 8 bits packed from the high bits
+static std::vector<u8> packLine(const TestCase &test, u32 width, u32 y, u32 xStart, u32 xStep) {
+    std::vector<u8> line;
+    u32 bit = 0;
+    for (u32 x = xStart; x < width; x += xStep) {
+        for (u16 sample : test.samples(x, y)) {
+            if (test.bitDepth == 16) {
+                line.push_back(static_cast<u8>(sample >> 8));
+                line.push_back(static_cast<u8>(sample));
+            } else if (test.bitDepth == 8) {
+                line.push_back(static_cast<u8>(sample));
+            } else {
+                if (bit % 8 == 0) {
+                    line.push_back(0);
+                }
+                line.back() |= static_cast<u8>(sample << (8 - test.bitDepth - bit % 8));
+                bit += test.bitDepth;
+            }
+        }
+    }
+    return line;
+}
+
+static std::string encodePNG(const TestCase &test, u32 width, u32 height, bool interlaced) {
+    // xStart, yStart, xStep, yStep of the Adam7 passes
+    static const std::vector<std::array<u32, 4>> adam7{
+        { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+    };
+    static const std::vector<std::array<u32, 4>> noInterlacing{ { 0, 0, 1, 1 } };
+    const size_t dist = std::max<size_t>(1, channels(test.colorType) * test.bitDepth / 8);
+
+    std::string raw;
+    for (const std::array<u32, 4> &pass : interlaced ? adam7 : noInterlacing) {
+        std::vector<u8> prevLine;
+        u32 lineNumber = 0;
+        for (u32 y = pass[1]; y < height; y += pass[3]) {
+            const std::vector<u8> line = packLine(test, width, y, pass[0], pass[2]);
+            if (line.empty()) {
+                // empty passes have no lines
+                break;
+            }
+            prevLine.resize(line.size(), 0);
+            const u8 filterType = static_cast<u8>(lineNumber++ % 5);
+            raw.push_back(static_cast<char>(filterType));
+            for (size_t i = 0; i < line.size(); i++) {
+                const int a = i >= dist ? line[i - dist] : 0;
+                const int b = prevLine[i];
+                const int c = i >= dist ? prevLine[i - dist] : 0;
+                const int predictors[5] = { 0, a, b, (a + b) / 2, paethPredictor(a, b, c) };
+                raw.push_back(static_cast<char>(line[i] - predictors[filterType]));
+            }
+            prevLine = line;
+        }
+    }
+
+    std::vector<Bytef> compressed(compressBound(static_cast<uLong>(raw.size())));
+    uLongf compressedSize = static_cast<uLongf>(compressed.size());
+    if (compress(compressed.data(), &compressedSize, reinterpret_cast<const Bytef *>(raw.data()), static_cast<uLong>(raw.size())) != Z_OK) {
+        throw std::runtime_error("compress failed");
+    }
+    const std::string data(compressed.begin(), compressed.begin() + compressedSize);
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    std::string ihdr;
+    appendU32(ihdr, width);
+    appendU32(ihdr, height);
+    ihdr += { static_cast<char>(test.bitDepth), static_cast<char>(test.colorType), 0, 0, static_cast<char>(interlaced ? 1 : 0) };
+    appendChunk(png, "IHDR", ihdr);
+    if (!test.palette.empty()) {
+        appendChunk(png, "PLTE", std::string(test.palette.begin(), test.palette.end()));
+    }
+    if (!test.transparency.empty()) {
+        appendChunk(png, "tRNS", std::string(test.transparency.begin(), test.transparency.end()));
+    }
+    // the data is split into two IDAT chunks
+    appendChunk(png, "IDAT", data.substr(0, data.size() / 2));
+    appendChunk(png, "IDAT", data.substr(data.size() / 2));
+    appendChunk(png, "IEND", "");
+    return png;
+}
+
+// the texel at x, y of the full resolution level, the texture coordinates map 0..1 to the first..last texel
+static UColor texel(const Texture &texture, u32 x, u32 y) {
+    const UDim2 size = texture.size();
+    auto coordinate = [] (u32 i, u32 count) {
+        return count == 1 ? 0.0f : i + 1 == count ? std::nextafter(1.0f, 0.0f) : static_cast<scalar>(i) / (count - 1);
+    };
+    const Color color = texture.sample(Point2{ coordinate(x, size.x), coordinate(y, size.y) });
+    auto toU8 = [] (scalar value) { return static_cast<u8>(std::lround(value * 255.0f)); };
+    return UColor{ toU8(color.r), toU8(color.g), toU8(color.b), toU8(color.a) };
+}
+
+static std::string toString(UColor color) {
+    return "(" + std::to_string(color.r) + ", " + std::to_string(color.g) + ", " + std::to_string(color.b) + ", " + std::to_string(color.a) + ")";
+}
+
+static void test(const TestCase &test, u32 width, u32 height, bool interlaced) {
+    const std::string name = test.name + (interlaced ? " interlaced " : " ") + std::to_string(width) + "x" + std::to_string(height);
+    std::istringstream in(encodePNG(test, width, height, interlaced));
+    const Texture texture = readPNG(in);
+    if (texture.size().x != width || texture.size().y != height) {
+        throw std::runtime_error(name + ": wrong size");
+    }
+    for (u32 y = 0; y < height; y++) {
+        for (u32 x = 0; x < width; x++) {
+            const UColor color = texel(texture, x, y);
+            const UColor expected = test.expected(x, y);
+            if (color.rgba() != expected.rgba()) {
+                throw std::runtime_error(name + ": texel " + std::to_string(x) + ", " + std::to_string(y) + " is " +
+                    toString(color) + " (expected: " + toString(expected) + ")");
+            }
+        }
+    }
+}
+
+static u8 gray(u32 x, u32 y) {
+    return static_cast<u8>(x * 25 + y * 3);
+}
+
+int main() {
+    // palette entry i is (i * 16, 255 - i * 16, i), the first 3 entries get the alpha values of tRNS
+    std::vector<u8> palette;
+    for (u32 i = 0; i < 16; i++) {
+        palette.insert(palette.end(), { static_cast<u8>(i * 16), static_cast<u8>(255 - i * 16), static_cast<u8>(i) });
+    }
+    const std::vector<u8> paletteAlpha{ 0, 100, 200 };
+    auto paletteColor = [] (u32 i) {
+        const u8 alpha = i == 0 ? 0 : i == 1 ? 100 : i == 2 ? 200 : 255;
+        return UColor{ static_cast<u8>(i * 16), static_cast<u8>(255 - i * 16), static_cast<u8>(i), alpha };
+    };
+
+    const std::vector<TestCase> tests{
+        { "gray 1 bit", 0, 1,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + y) % 2) }; },
+            [] (u32 x, u32 y) { return (x + y) % 2 ? UColor{ 255, 255, 255, 255 } : UColor{ 0, 0, 0, 255 }; } },
+        { "gray 2 bit", 0, 2,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + 2 * y) % 4) }; },
+            [] (u32 x, u32 y) { const u8 v = static_cast<u8>((x + 2 * y) % 4 * 85); return UColor{ v, v, v, 255 }; } },
+        { "gray 4 bit", 0, 4,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + 3 * y) % 16) }; },
+            [] (u32 x, u32 y) { const u8 v = static_cast<u8>((x + 3 * y) % 16 * 17); return UColor{ v, v, v, 255 }; } },
+        { "gray 8 bit with transparent gray", 0, 8,
+            [] (u32 x, u32 y) { return std::vector<u16>{ gray(x, y) }; },
+            [] (u32 x, u32 y) { const u8 v = gray(x, y); return UColor{ v, v, v, static_cast<u8>(v == 28 ? 0 : 255) }; },
+            {}, { 0, 28 } },
+        { "gray 16 bit", 0, 16,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>(gray(x, y) << 8 | 0xa5) }; },
+            [] (u32 x, u32 y) { const u8 v = gray(x, y); return UColor{ v, v, v, 255 }; } },
+        { "truecolor 8 bit", 2, 8,
+            [] (u32 x, u32 y) { return std::vector<u16>{ gray(x, y), static_cast<u16>(255 - x), static_cast<u16>(y * 30) }; },
+            [] (u32 x, u32 y) { return UColor{ gray(x, y), static_cast<u8>(255 - x), static_cast<u8>(y * 30), 255 }; } },
+        { "truecolor 16 bit with transparent color", 2, 16,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>(x * 1000), static_cast<u16>(y * 1000), 0x1234 }; },
+            [] (u32 x, u32 y) {
+                return UColor{ static_cast<u8>(x * 1000 >> 8), static_cast<u8>(y * 1000 >> 8), 0x12, static_cast<u8>(x == 1 && y == 1 ? 0 : 255) };
+            },
+            {}, { 0x03, 0xe8, 0x03, 0xe8, 0x12, 0x34 } },
+        { "indexed 1 bit", 3, 1,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + y) % 2) }; },
+            [paletteColor] (u32 x, u32 y) { return paletteColor((x + y) % 2); },
+            palette, paletteAlpha },
+        { "indexed 2 bit", 3, 2,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + y) % 4) }; },
+            [paletteColor] (u32 x, u32 y) { return paletteColor((x + y) % 4); },
+            palette, paletteAlpha },
+        { "indexed 4 bit", 3, 4,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x + 5 * y) % 16) }; },
+            [paletteColor] (u32 x, u32 y) { return paletteColor((x + 5 * y) % 16); },
+            palette, paletteAlpha },
+        { "indexed 8 bit without transparency", 3, 8,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>((x * y) % 16) }; },
+            [paletteColor] (u32 x, u32 y) { UColor color = paletteColor((x * y) % 16); color.a = 255; return color; },
+            palette },
+        { "gray alpha 8 bit", 4, 8,
+            [] (u32 x, u32 y) { return std::vector<u16>{ gray(x, y), static_cast<u16>(255 - gray(x, y)) }; },
+            [] (u32 x, u32 y) { const u8 v = gray(x, y); return UColor{ v, v, v, static_cast<u8>(255 - v) }; } },
+        { "gray alpha 16 bit", 4, 16,
+            [] (u32 x, u32 y) { return std::vector<u16>{ static_cast<u16>(gray(x, y) * 257), static_cast<u16>(x * 7000) }; },
+            [] (u32 x, u32 y) { const u8 v = gray(x, y); return UColor{ v, v, v, static_cast<u8>(x * 7000 >> 8) }; } },
+        { "truecolor alpha 8 bit", 6, 8,
+            [] (u32 x, u32 y) { return std::vector<u16>{ gray(x, y), static_cast<u16>(x * 10), static_cast<u16>(y * 10), static_cast<u16>(x * 30) }; },
+            [] (u32 x, u32 y) { return UColor{ gray(x, y), static_cast<u8>(x * 10), static_cast<u8>(y * 10), static_cast<u8>(x * 30) }; } },
+        { "truecolor alpha 16 bit", 6, 16,
+            [] (u32 x, u32 y) {
+                return std::vector<u16>{ static_cast<u16>(gray(x, y) * 257), static_cast<u16>(x * 5000), static_cast<u16>(y * 5000), 0xfffe };
+            },
+            [] (u32 x, u32 y) { return UColor{ gray(x, y), static_cast<u8>(x * 5000 >> 8), static_cast<u8>(y * 5000 >> 8), 255 }; } },
+    };
+
+    try {
+        for (const TestCase &testCase : tests) {
+            for (bool interlaced : { false, true }) {
+                // all Adam7 passes have pixels, and a tiny image where some passes are empty
+                test(testCase, 9, 7, interlaced);
+                test(testCase, 3, 2, interlaced);
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cout << "test failed:" << std::endl << e.what() << std::endl;
+        return -1;
+    }
+    std::cout << "All tests OK" << std::endl;
+    return 0;
+}
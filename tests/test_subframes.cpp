@@ -0,0 +1,145 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/raytracer.h"
+#include "../src/scene.h"
+
+static const std::string SCENE_FILE_NAME = "test_subframes.xml";
+static const std::vector<scalar> SUBFRAME_TIMES{ 0.0f, 0.1f, 0.2f, 0.3f };
+
+// a moving sphere beside a static one, options are inserted into the camera and the lights tag
+static void writeScene(const std::string &cameraOptions, const std::string &lightsOptions) {
+    std::ofstream out(SCENE_FILE_NAME);
+    out << R"(<?xml version="1.0" standalone="no" ?>
+<scene output_file="test_subframes.png">
+    <background_color r="0.1" g="0.1" b="0.1"/>
+    <animation length="1" fps="1"/>
+    <camera>
+        <position x="0.0" y="0.0" z="1.0"/>
+        <lookat x="0.0" y="0.0" z="-2.5"/>
+        <up x="0.0" y="1.0" z="0.0"/>
+        <horizontal_fov angle="45"/>
+        <resolution horizontal="64" vertical="48"/>
+        <max_bounces n="4"/>
+        )" << cameraOptions << R"(
+    </camera>
+    <lights )" << lightsOptions << R"(>
+        <ambient_light>
+            <color r="0.3" g="0.3" b="0.3"/>
+        </ambient_light>
+        <point_light>
+            <color r="0.5" g="0.5" b="0.5"/>
+            <position x="2.0" y="3.0" z="0.0"/>
+        </point_light>
+        <point_light>
+            <color r="0.5" g="0.5" b="0.5"/>
+            <position x="-2.0" y="3.0" z="0.0"/>
+        </point_light>
+    </lights>
+    <surfaces>
+        <sphere radius="1.0">
+            <position x="-2.5;-1.5" y="-1.0" z="-4.0"/>
+            <material_solid>
+                <color r="0.5" g="0.17" b="0.18"/>
+                <phong ka="0.3" kd="0.9" ks="1.0" exponent="200"/>
+                <reflectance r="0.0"/>
+                <transmittance t="0.0"/>
+                <refraction iof="0.0"/>
+            </material_solid>
+        </sphere>
+        <sphere radius="1.0">
+            <position x="1.5" y="0.5" z="-4.0"/>
+            <material_solid>
+                <color r="0.17" g="0.18" b="0.5"/>
+                <phong ka="0.3" kd="0.9" ks="1.0" exponent="200"/>
+                <reflectance r="0.0"/>
+                <transmittance t="0.0"/>
+                <refraction iof="0.0"/>
+            </material_solid>
+        </sphere>
+    </surfaces>
+</scene>
+)";
+}
+
+struct Frame {
+    Picture picture;
+    u64 reusedPixels = 0;
+};
+
+// renders the subframes like main.cpp, with reuse the static pixels are kept if the scene allows it
+static Frame renderFrame(bool reuse) {
+    std::vector<Scene> scenes;
+    for (scalar time : SUBFRAME_TIMES) {
+        scenes.push_back(Scene::load(SCENE_FILE_NAME, time));
+    }
+    RayTracer raytracer;
+    if (reuse && scenes.front().staticPixelsReusable()) {
+        std::vector<BoundingBox> bounds = scenes.front().animatedBounds();
+        for (const Scene &scene : scenes) {
+            const std::vector<BoundingBox> sceneBounds = scene.animatedBounds();
+            for (size_t object = 0; object < bounds.size(); object++) {
+                bounds[object].extend(sceneBounds[object]);
+            }
+        }
+        raytracer.setAnimatedBounds(std::move(bounds));
+    }
+    const UDim2 resolution = scenes.front().camera().resolution();
+    Frame frame{ Picture{ resolution } };
+    Picture subPicture{ resolution };
+    for (const Scene &scene : scenes) {
+        raytracer.raytrace(scene, subPicture, {});
+        frame.reusedPixels += raytracer.statistics().reusedPixels;
+        frame.picture.mulAdd(subPicture, 1.0f / SUBFRAME_TIMES.size());
+    }
+    return frame;
+}
+
+static bool samePicture(const Picture &a, const Picture &b) {
+    std::vector<Radiance> lineA(a.size().x), lineB(b.size().x);
+    for (u32 y = 0; y < a.size().y; y++) {
+        a.getLine(y, 1.0f, lineA.data());
+        b.getLine(y, 1.0f, lineB.data());
+        for (u32 x = 0; x < a.size().x; x++) {
+            if (lineA[x].r != lineB[x].r || lineA[x].g != lineB[x].g || lineA[x].b != lineB[x].b || lineA[x].a != lineB[x].a) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// the static pixel reuse must give the same frame as rendering all pixels in all subframes
+static void test(const std::string &name, const std::string &cameraOptions, const std::string &lightsOptions, bool expectReuse) {
+    writeScene(cameraOptions, lightsOptions);
+    const Frame all = renderFrame(false);
+    const Frame reused = renderFrame(true);
+    if ((reused.reusedPixels > 0) != expectReuse) {
+        throw std::runtime_error(name + ": " + std::to_string(reused.reusedPixels) + " reused pixels");
+    }
+    if (!samePicture(all.picture, reused.picture)) {
+        throw std::runtime_error(name + ": the frame differs with reused pixels");
+    }
+}
+
+int main() {
+    try {
+        test("static samples", R"(<supersampling subpixels_peraxis="2"/>)", "", true);
+        // the lens samples depend on the time, every subframe adds other ones
+        test("depth of field", R"(<supersampling subpixels_peraxis="2"/><dof x="0.0" y="0.0" z="-3.0" lenssize="0.1"/>)", "", false);
+        test("random pattern", R"(<supersampling samples="4" pattern="cmj"/>)", "", false);
+        test("light selection", "", R"(shadow_rays="1")", false);
+    } catch (const std::exception &e) {
+        std::remove(SCENE_FILE_NAME.c_str());
+        std::cout << "test failed:" << std::endl << e.what() << std::endl;
+        return -1;
+    }
+    std::remove(SCENE_FILE_NAME.c_str());
+    std::cout << "All tests OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/binfilehelper.h"
+#include "../src/tiles.h"
+
+static const std::string TILE_FILE_MAGIC{ 'R', 'T', 'T', 'I', 'L', 'E', 'S', 1 };
+
+// tile file with the given header and tileCount tiles numbered from 0, with a valid checksum
+static std::string tileFile(UDim2 size, u32 tileCount) {
+    std::ostringstream out;
+    out.write(TILE_FILE_MAGIC.data(), TILE_FILE_MAGIC.size());
+    LittleEndianWriter writer(out);
+    writer.write(size.x);
+    writer.write(size.y);
+    writer.write(Picture::TILE_SIZE);
+    writer.write(tileCount);
+    const std::vector<scalar> values(Picture::TILE_VALUES, 0.5f);
+    for (u32 tile = 0; tile < tileCount; tile++) {
+        writer.write(tile);
+        writer.write(values.data(), values.size());
+    }
+    writer.write(writer.getAndResetCRC());
+    return out.str();
+}
+
+static void testRejected(const std::string &name, UDim2 size, u32 tileCount) {
+    std::istringstream in(tileFile(size, tileCount));
+    Picture picture;
+    try {
+        readTiles(in, picture);
+    } catch (const std::runtime_error &) {
+        if (!picture.empty()) {
+            throw std::runtime_error(name + ": picture changed by a rejected tile file");
+        }
+        return;
+    }
+    throw std::runtime_error(name + ": tile file accepted");
+}
+
+static void testRoundTrip() {
+    Picture picture(UDim2{ 40, 20 }, Radiance{ 0.25f, 0.5f, 0.75f, 1.0f });
+    std::ostringstream out;
+    writeTiles(out, picture, { 0, 5 });
+    std::istringstream in(out.str());
+    Picture read;
+    const std::vector<u32> tiles = readTiles(in, read);
+    std::vector<scalar> expected(Picture::TILE_VALUES), values(Picture::TILE_VALUES);
+    picture.getTile(5, expected.data());
+    read.getTile(5, values.data());
+    if (tiles != std::vector<u32>{ 0, 5 } || read.size().x != 40 || read.size().y != 20 || values != expected) {
+        throw std::runtime_error("round trip: tiles differ");
+    }
+}
+
+static void testPictureTiles() {
+    // the tile count must not wrap for sizes near the u32 limit
+    if (Picture::tilesFor(0xFFFFFFF8u) != 0x10000000u || Picture::tilesFor(0) != 0 || Picture::tilesFor(17) != 2) {
+        throw std::runtime_error("Picture::tilesFor() wrong");
+    }
+}
+
+int main() {
+    try {
+        testRoundTrip();
+        testPictureTiles();
+        // the tile columns wrapped to 0, tile 0 was written past an empty picture
+        testRejected("width near the u32 limit", UDim2{ 0xFFFFFFF8u, 1 }, 1);
+        testRejected("height near the u32 limit", UDim2{ 1, 0xFFFFFFF1u }, 1);
+        // a small file must not request a huge allocation
+        testRejected("huge picture", UDim2{ 0x10000000u, 0x100u }, 1);
+        testRejected("empty picture", UDim2{ 0, 16 }, 0);
+    } catch (const std::exception &e) {
+        std::cout << "test failed:" << std::endl << e.what() << std::endl;
+        return -1;
+    }
+    std::cout << "All tests OK" << std::endl;
+    return 0;
+}